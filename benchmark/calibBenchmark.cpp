@@ -0,0 +1,380 @@
+#include <opencv2/core.hpp>
+#include <opencv2/cvconfig.h>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "calibCommon.hpp"
+#include "calibController.hpp"
+#include "cvCalibrationFork.hpp"
+#include "display.hpp"
+#include "frameProcessor.hpp"
+#include "linalg.hpp"
+#include "syntheticBoard.hpp"
+
+using namespace calib;
+
+#define SOLVER_IMAGE_WIDTH 1280
+#define SOLVER_IMAGE_HEIGHT 720
+#define POINTS_NOISE_SIGMA 0.3
+#define FILTER_CALLS_NUM 10
+
+const std::string keys  =
+        "{bench    | all     | Benchmarks to run (detection, solver, derivatives, linalg, filter or all) }"
+        "{frames   | 20      | Rendered frames per template and resolution }"
+        "{repeats  | 3       | Runs of every solver and linear algebra case }"
+        "{o        |         | Output CSV file }"
+        "{help     |         | Print help }";
+
+struct benchmarkResult
+{
+    std::string bench;
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+static std::vector<benchmarkResult> results;
+
+static void report(const std::string& bench, const std::string& name, double value, const std::string& unit)
+{
+    benchmarkResult result = { bench, name, value, unit };
+    results.push_back(result);
+    std::cout << bench << "\t" << name << "\t" << value << " " << unit << std::endl;
+}
+
+template <typename F>
+static double measure(F function)
+{
+    using namespace std::chrono;
+    auto startPoint = high_resolution_clock::now();
+    function();
+    return duration_cast<duration<double, std::milli>>(high_resolution_clock::now() - startPoint).count();
+}
+
+static captureParameters createBoardParameters(TemplateType board)
+{
+    captureParameters params;
+    params.captureMethod = InputType::Pictures;
+    params.source = InputVideoSource::File;
+    params.board = board;
+    params.squareSize = 16.3f;
+    params.templDst = 295.f;
+    params.captureDelay = 1.f;
+    params.flipVertical = false;
+    params.camID = 0;
+    params.charucoDictName = 0;
+    params.charucoSquareLenght = 200;
+    params.charucoMarkerSize = 100;
+
+    switch(board)
+    {
+    case TemplateType::AcirclesGrid:
+    case TemplateType::DoubleAcirclesGrid:
+        params.boardSize = cv::Size(4, 11);
+        break;
+    case TemplateType::Chessboard:
+        params.boardSize = cv::Size(7, 7);
+        break;
+    case TemplateType::chAruco:
+        params.boardSize = cv::Size(6, 8);
+        break;
+    }
+    return params;
+}
+
+static std::string getBoardName(TemplateType board)
+{
+    switch(board)
+    {
+    case TemplateType::AcirclesGrid:
+        return "circles";
+    case TemplateType::Chessboard:
+        return "chessboard";
+    case TemplateType::DoubleAcirclesGrid:
+        return "dualCircles";
+    case TemplateType::chAruco:
+        return "chAruco";
+    }
+    return "";
+}
+
+// the processor builds the board model exactly as the application does
+static std::vector<cv::Point3f> getBoardPoints(captureParameters& params)
+{
+    Sptr<calibrationData> data(new calibrationData);
+    CalibProcessor processor(data, params);
+    return data->points.getBoardModel()->getPoints();
+}
+
+static void fillViews(captureParameters& params, size_t viewsNum, cv::Size imageSize, calibrationData& data)
+{
+    std::vector<cv::Point3f> boardPoints = getBoardPoints(params);
+    data.points.setBoardModel(std::make_shared<const BoardModel>(boardPoints));
+    SyntheticBoard board(params, boardPoints);
+    cv::Mat cameraMatrix = SyntheticBoard::createCameraMatrix(imageSize);
+    cv::Mat distCoeffs = SyntheticBoard::createDistCoeffs();
+
+    data.imageSize = imageSize;
+    for(size_t i = 0; i < viewsNum; i++) {
+        cv::Mat rvec, tvec;
+        std::vector<cv::Point2f> imagePoints;
+        board.generatePose(cameraMatrix, imageSize, rvec, tvec);
+        board.projectView(rvec, tvec, cameraMatrix, distCoeffs, POINTS_NOISE_SIGMA, imagePoints);
+        data.points.addView(imagePoints);
+    }
+}
+
+static double getMeanDistanceToNearest(const std::vector<cv::Point2f>& points, const std::vector<cv::Point2f>& truth)
+{
+    double sum = 0;
+    for(const cv::Point2f& point : points) {
+        double minDist = DBL_MAX;
+        for(const cv::Point2f& truePoint : truth)
+            minDist = std::min(minDist, (double)cv::norm(point - truePoint));
+        sum += minDist;
+    }
+    return points.empty() ? 0 : sum / points.size();
+}
+
+static void benchmarkDetection(int framesNum)
+{
+    const TemplateType boards[] = { TemplateType::Chessboard, TemplateType::AcirclesGrid,
+                                    TemplateType::DoubleAcirclesGrid, TemplateType::chAruco };
+    const cv::Size resolutions[] = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+
+    for(TemplateType boardType : boards)
+        for(const cv::Size& imageSize : resolutions) {
+            captureParameters params = createBoardParameters(boardType);
+            SyntheticBoard board(params, getBoardPoints(params));
+            cv::Mat cameraMatrix = SyntheticBoard::createCameraMatrix(imageSize);
+            cv::Mat distCoeffs = SyntheticBoard::createDistCoeffs();
+
+            std::vector<cv::Mat> frames(framesNum);
+            std::vector<std::vector<cv::Point2f>> truePoints(framesNum);
+            for(int i = 0; i < framesNum; i++) {
+                cv::Mat rvec, tvec;
+                board.generatePose(cameraMatrix, imageSize, rvec, tvec);
+                board.projectView(rvec, tvec, cameraMatrix, distCoeffs, 0, truePoints[i]);
+                board.renderView(rvec, tvec, cameraMatrix, distCoeffs, imageSize, frames[i]);
+            }
+
+            Sptr<calibrationData> data(new calibrationData);
+            data->imageSize = imageSize;
+            CalibProcessor processor(data, params);
+            double totalTime = 0, totalError = 0;
+            int foundNum = 0;
+            for(int i = 0; i < framesNum; i++) {
+                std::vector<cv::Point2f> imagePoints;
+                std::vector<int> pointIds;
+                bool isFound = false;
+                totalTime += measure([&]() { isFound = processor.detectTemplate(frames[i], imagePoints, pointIds); });
+                if(isFound) {
+                    foundNum++;
+                    totalError += getMeanDistanceToNearest(imagePoints, truePoints[i]);
+                }
+            }
+
+            std::string name = cv::format("%s_%dx%d", getBoardName(boardType).c_str(), imageSize.width, imageSize.height);
+            report("detection", name + "_time", totalTime / framesNum, "ms");
+            report("detection", name + "_found", 100.*foundNum / framesNum, "%");
+            if(foundNum)
+                report("detection", name + "_error", totalError / foundNum, "px");
+        }
+}
+
+static void benchmarkSolver(int repeats)
+{
+    const size_t viewsNums[] = { 10, 20, 50, 100, 200, 500 };
+    const int solverFlags[] = { 0, CALIB_USE_QR, CALIB_USE_CHOLESKY, CALIB_USE_SCHUR,
+                                CALIB_USE_SCHUR | CALIB_USE_CHOLESKY };
+    const char* solverNames[] = { "LU", "QR", "Cholesky", "Schur", "Schur_Cholesky" };
+    cv::Size imageSize(SOLVER_IMAGE_WIDTH, SOLVER_IMAGE_HEIGHT);
+    cv::Mat trueCameraMatrix = SyntheticBoard::createCameraMatrix(imageSize);
+    cv::TermCriteria termCrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 1e-7);
+
+    for(size_t viewsNum : viewsNums) {
+        captureParameters params = createBoardParameters(TemplateType::Chessboard);
+        calibrationData data;
+        fillViews(params, viewsNum, imageSize, data);
+        cv::Mat objectPoints, imagePoints, npoints;
+        data.points.getPacked(objectPoints, imagePoints, npoints);
+
+        for(size_t s = 0; s < sizeof(solverFlags) / sizeof(solverFlags[0]); s++) {
+            double totalTime = 0, rms = 0, focalError = 0;
+            for(int r = 0; r < repeats; r++) {
+                cv::Mat cameraMatrix, distCoeffs, stdDeviations, perViewErrors;
+                std::vector<cv::Mat> rvecs, tvecs;
+                totalTime += measure([&]() {
+                    rms = cvfork::calibrateCameraPacked(objectPoints, imagePoints, npoints, imageSize, cameraMatrix,
+                                                        distCoeffs, rvecs, tvecs, stdDeviations, perViewErrors,
+                                                        solverFlags[s], termCrit);
+                });
+                focalError = std::fabs(cameraMatrix.at<double>(0, 0) - trueCameraMatrix.at<double>(0, 0));
+            }
+
+            std::string name = cv::format("%s_%d_views", solverNames[s], (int)viewsNum);
+            report("solver", name + "_time", totalTime / repeats, "ms");
+            report("solver", name + "_rms", rms, "px");
+            report("solver", name + "_focal_error", focalError, "px");
+        }
+    }
+}
+
+struct projectionCase
+{
+    const char* name;
+    int flags;
+    bool rationalCoeffs;
+    bool thinPrismCoeffs;
+};
+
+// the specialised projections of the solver against central differences and projectPoints
+static void benchmarkDerivatives()
+{
+    // the guessed case has no model flags, its nonzero coefficients have to select the full projection
+    const projectionCase cases[] = {
+        { "default", 0, false, false },
+        { "zeroTangent", cv::CALIB_ZERO_TANGENT_DIST, false, false },
+        { "fixK3", cv::CALIB_FIX_K3, false, false },
+        { "rational", cv::CALIB_RATIONAL_MODEL, true, false },
+        { "thinPrism", cv::CALIB_THIN_PRISM_MODEL, false, true },
+        { "rational_thinPrism", cv::CALIB_RATIONAL_MODEL | cv::CALIB_THIN_PRISM_MODEL, true, true },
+        { "guessed_rational_thinPrism", 0, true, true }
+    };
+    cv::Size imageSize(SOLVER_IMAGE_WIDTH, SOLVER_IMAGE_HEIGHT);
+    captureParameters params = createBoardParameters(TemplateType::Chessboard);
+    std::vector<cv::Point3f> boardPoints = getBoardPoints(params);
+    SyntheticBoard board(params, boardPoints);
+    cv::Mat cameraMatrix = SyntheticBoard::createCameraMatrix(imageSize);
+    cv::Mat rvec, tvec;
+    board.generatePose(cameraMatrix, imageSize, rvec, tvec);
+
+    for(const projectionCase& projection : cases) {
+        cv::Mat distCoeffs = cv::Mat::zeros(1, 14, CV_64F);
+        SyntheticBoard::createDistCoeffs().copyTo(distCoeffs.colRange(0, 5));
+        if(projection.rationalCoeffs)
+            distCoeffs.colRange(5, 8) = cv::Scalar(1e-2);
+        if(projection.thinPrismCoeffs)
+            distCoeffs.colRange(8, 12) = cv::Scalar(1e-3);
+
+        double projectionError = 0;
+        double derivativeError = cvfork::checkProjectionKernel(boardPoints, rvec, tvec, cameraMatrix, distCoeffs,
+                                                               projection.flags, projectionError);
+        report("derivatives", std::string(projection.name) + "_jacobian_error", derivativeError, "rel");
+        report("derivatives", std::string(projection.name) + "_projection_error", projectionError, "px");
+    }
+}
+
+static void benchmarkLinalg(int repeats)
+{
+    const int viewsNums[] = { 10, 50, 100 };
+    const int methods[] = { cv::DECOMP_LU, cv::DECOMP_QR };
+    const char* methodNames[] = { "LU", "QR" };
+    cv::RNG rng(0x12345678);
+
+#ifndef USE_LAPACK
+    std::cout << "Built without USE_LAPACK, only OpenCV routines are measured" << std::endl;
+#endif
+    for(int viewsNum : viewsNums) {
+        // the size of the normal equations for that many views
+        int n = CV_CALIB_NINTRINSIC + 6*viewsNum;
+        cv::Mat A(n, n, CV_64F), b(n, 1, CV_64F), x, inverted;
+        rng.fill(A, cv::RNG::NORMAL, 0, 1);
+        rng.fill(b, cv::RNG::NORMAL, 0, 1);
+        cv::Mat JtJ = A.t()*A + cv::Mat::eye(n, n, CV_64F)*n;
+
+        for(size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+            std::string name = cv::format("solve_%s_%d", methodNames[m], n);
+            double time = measure([&]() { for(int r = 0; r < repeats; r++) cv::solve(JtJ, b, x, methods[m]); });
+            report("linalg", "opencv_" + name, time / repeats, "ms");
+#ifdef USE_LAPACK
+            time = measure([&]() { for(int r = 0; r < repeats; r++) cvfork::solve(JtJ, b, x, methods[m]); });
+            report("linalg", "lapack_" + name, time / repeats, "ms");
+#endif
+        }
+        double time = measure([&]() { for(int r = 0; r < repeats; r++) cvfork::solveCholesky(JtJ, b, x); });
+        report("linalg", cv::format("cvfork_solve_Cholesky_%d", n), time / repeats, "ms");
+
+        std::string name = cv::format("invert_SVD_%d", n);
+        time = measure([&]() { for(int r = 0; r < repeats; r++) cv::invert(JtJ, inverted, cv::DECOMP_SVD); });
+        report("linalg", "opencv_" + name, time / repeats, "ms");
+#ifdef USE_LAPACK
+        time = measure([&]() { for(int r = 0; r < repeats; r++) cvfork::invert(JtJ, inverted, cv::DECOMP_SVD); });
+        report("linalg", "lapack_" + name, time / repeats, "ms");
+#endif
+    }
+}
+
+static void benchmarkFilter()
+{
+    const size_t viewsNums[] = { 30, 100, 300 };
+    cv::Size imageSize(SOLVER_IMAGE_WIDTH, SOLVER_IMAGE_HEIGHT);
+    cv::RNG rng(0x12345678);
+
+#ifdef HAVE_QT
+    // filterFrames reports the removed frame as an overlay of the main window
+    Display::instance().start();
+    Display::instance().createWindow(mainWindowName, cv::Point(10, 10));
+#endif
+    for(size_t viewsNum : viewsNums) {
+        captureParameters params = createBoardParameters(TemplateType::Chessboard);
+        Sptr<calibrationData> data(new calibrationData);
+        fillViews(params, viewsNum, imageSize, *data);
+        data->coverage.rebuild(imageSize, data->points);
+        data->perViewErrors = cv::Mat((int)viewsNum, 1, CV_64F);
+        rng.fill(data->perViewErrors, cv::RNG::UNIFORM, 0.1, 1.);
+
+        calibDataController controller(data, 1, 0.1);
+        double time = measure([&]() {
+            for(int i = 0; i < FILTER_CALLS_NUM; i++)
+                controller.filterFrames();
+        });
+        report("filter", cv::format("filterFrames_%d_views", (int)viewsNum), time / FILTER_CALLS_NUM, "ms");
+    }
+#ifdef HAVE_QT
+    Display::instance().stop();
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    cv::CommandLineParser parser(argc, argv, keys);
+    if(parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    std::string bench = parser.get<std::string>("bench");
+    int framesNum = std::max(parser.get<int>("frames"), 1);
+    int repeats = std::max(parser.get<int>("repeats"), 1);
+
+    try {
+        if(bench == "all" || bench == "detection")
+            benchmarkDetection(framesNum);
+        if(bench == "all" || bench == "solver")
+            benchmarkSolver(repeats);
+        if(bench == "all" || bench == "derivatives")
+            benchmarkDerivatives();
+        if(bench == "all" || bench == "linalg")
+            benchmarkLinalg(repeats);
+        if(bench == "all" || bench == "filter")
+            benchmarkFilter();
+    }
+    catch(const cv::Exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    if(parser.has("o")) {
+        std::ofstream output(parser.get<std::string>("o"));
+        output << "bench,case,value,unit" << std::endl;
+        for(const benchmarkResult& result : results)
+            output << result.bench << "," << result.name << "," << result.value << "," << result.unit << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include "syntheticBoard.hpp"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/aruco/charuco.hpp>
+#include <algorithm>
+#include <cfloat>
+
+using namespace calib;
+
+#define BOARD_PIXELS_PER_SQUARE 48
+#define BACKGROUND_COLOR 128
+#define IMAGE_NOISE_SIGMA 3
+#define MAX_TILT_ANGLE 25
+#define MAX_ROLL_ANGLE 15
+
+static cv::Rect2f getBoundingBox(const std::vector<cv::Point3f>& points, size_t begin, size_t end)
+{
+    cv::Point2f minPoint(FLT_MAX, FLT_MAX), maxPoint(-FLT_MAX, -FLT_MAX);
+    for(size_t i = begin; i < end; i++) {
+        minPoint.x = std::min(minPoint.x, points[i].x);
+        minPoint.y = std::min(minPoint.y, points[i].y);
+        maxPoint.x = std::max(maxPoint.x, points[i].x);
+        maxPoint.y = std::max(maxPoint.y, points[i].y);
+    }
+    return cv::Rect2f(minPoint, maxPoint);
+}
+
+SyntheticBoard::SyntheticBoard(const captureParameters &params, const std::vector<cv::Point3f> &objectPoints,
+                               uint64 seed) :
+    mBoardType(params.board), mObjectPoints(objectPoints), mRng(seed)
+{
+    cv::Rect2f boardRect = getBoundingBox(mObjectPoints, 0, mObjectPoints.size());
+    mCenter = cv::Point3f(boardRect.x + boardRect.width / 2, boardRect.y + boardRect.height / 2, 0);
+    mExtent = std::max(boardRect.width, boardRect.height);
+
+    switch(mBoardType)
+    {
+    case TemplateType::Chessboard:
+        renderChessboard(params.boardSize, params.squareSize);
+        break;
+    case TemplateType::AcirclesGrid:
+        renderCircles(params.boardSize, params.squareSize, false);
+        break;
+    case TemplateType::DoubleAcirclesGrid:
+        renderCircles(params.boardSize, params.squareSize, true);
+        break;
+    case TemplateType::chAruco:
+        renderChAruco(params);
+        break;
+    }
+}
+
+void SyntheticBoard::renderChessboard(cv::Size boardSize, float squareSize)
+{
+    mPixelsPerUnit = BOARD_PIXELS_PER_SQUARE / squareSize;
+    mBoardOrigin = cv::Point2f(-2*squareSize, -2*squareSize);
+    int side = BOARD_PIXELS_PER_SQUARE;
+    mBoardImage = cv::Mat((boardSize.height + 3)*side, (boardSize.width + 3)*side, CV_8UC1, cv::Scalar(255));
+
+    for(int i = -1; i < boardSize.height; i++)
+        for(int j = -1; j < boardSize.width; j++)
+            if((i + j) % 2 == 0)
+                mBoardImage(cv::Rect((j + 2)*side, (i + 2)*side, side, side)).setTo(cv::Scalar(0));
+}
+
+void SyntheticBoard::renderCircles(cv::Size boardSize, float squareSize, bool isDual)
+{
+    size_t gridPointsNum = (size_t)boardSize.area();
+    cv::Rect2f boardRect = getBoundingBox(mObjectPoints, 0, mObjectPoints.size());
+    float margin = 2*squareSize;
+    mPixelsPerUnit = BOARD_PIXELS_PER_SQUARE / squareSize;
+    mBoardOrigin = cv::Point2f(boardRect.x - margin, boardRect.y - margin);
+    mBoardImage = cv::Mat(cvRound((boardRect.height + 2*margin)*mPixelsPerUnit),
+                          cvRound((boardRect.width + 2*margin)*mPixelsPerUnit), CV_8UC1, cv::Scalar(255));
+
+    auto toPixel = [this](const cv::Point3f& point) {
+        return cv::Point2f((point.x - mBoardOrigin.x)*mPixelsPerUnit, (point.y - mBoardOrigin.y)*mPixelsPerUnit);
+    };
+    int radius = cvRound(0.5*BOARD_PIXELS_PER_SQUARE);
+    const int shift = 4;
+
+    // the second grid of the dual template is light on a dark field, the detector inverts it
+    if(isDual) {
+        cv::Rect2f darkRect = getBoundingBox(mObjectPoints, gridPointsNum, mObjectPoints.size());
+        cv::Point2f topLeft = toPixel(cv::Point3f(darkRect.x - 1.5f*squareSize, darkRect.y - 1.5f*squareSize, 0));
+        cv::Point2f bottomRight = toPixel(cv::Point3f(darkRect.br().x + 1.5f*squareSize,
+                                                      darkRect.br().y + 1.5f*squareSize, 0));
+        cv::rectangle(mBoardImage, topLeft, bottomRight, cv::Scalar(0), cv::FILLED);
+    }
+    for(size_t i = 0; i < mObjectPoints.size(); i++) {
+        cv::Point2f center = toPixel(mObjectPoints[i])*(1 << shift);
+        cv::Scalar color = isDual && i >= gridPointsNum ? cv::Scalar(255) : cv::Scalar(0);
+        cv::circle(mBoardImage, cv::Point(cvRound(center.x), cvRound(center.y)), radius << shift,
+                   color, cv::FILLED, cv::LINE_AA, shift);
+    }
+}
+
+void SyntheticBoard::renderChAruco(const captureParameters &params)
+{
+    cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(
+                cv::aruco::PREDEFINED_DICTIONARY_NAME(params.charucoDictName));
+    cv::Ptr<cv::aruco::CharucoBoard> board = cv::aruco::CharucoBoard::create(
+                params.boardSize.width, params.boardSize.height, params.charucoSquareLenght,
+                params.charucoMarkerSize, dictionary);
+
+    float squareSize = params.charucoSquareLenght;
+    int side = BOARD_PIXELS_PER_SQUARE;
+    mPixelsPerUnit = BOARD_PIXELS_PER_SQUARE / squareSize;
+    mBoardOrigin = cv::Point2f(-squareSize, -squareSize);
+    mBoardImage = cv::Mat((params.boardSize.height + 2)*side, (params.boardSize.width + 2)*side,
+                          CV_8UC1, cv::Scalar(255));
+
+    // squares holding a marker stay white, the rest are black
+    cv::Mat hasMarker = cv::Mat::zeros(params.boardSize, CV_8U);
+    for(const std::vector<cv::Point3f>& corners : board->objPoints) {
+        cv::Point3f center = (corners[0] + corners[2])*0.5f;
+        hasMarker.at<uchar>((int)(center.y / squareSize), (int)(center.x / squareSize)) = 1;
+    }
+    for(int i = 0; i < params.boardSize.height; i++)
+        for(int j = 0; j < params.boardSize.width; j++)
+            if(!hasMarker.at<uchar>(i, j))
+                mBoardImage(cv::Rect((j + 1)*side, (i + 1)*side, side, side)).setTo(cv::Scalar(0));
+
+    // corner order of the board model decides the marker orientation in board coordinates
+    int markerSide = cvRound(params.charucoMarkerSize*mPixelsPerUnit);
+    for(size_t i = 0; i < board->ids.size(); i++) {
+        const std::vector<cv::Point3f>& corners = board->objPoints[i];
+        cv::Mat marker;
+        cv::aruco::drawMarker(dictionary, board->ids[i], markerSide, marker, 1);
+        bool isFlippedX = corners[1].x < corners[0].x, isFlippedY = corners[3].y < corners[0].y;
+        if(isFlippedX && isFlippedY)
+            cv::flip(marker, marker, -1);
+        else if(isFlippedX)
+            cv::flip(marker, marker, 1);
+        else if(isFlippedY)
+            cv::flip(marker, marker, 0);
+
+        float left = std::min(corners[0].x, corners[2].x), top = std::min(corners[0].y, corners[2].y);
+        cv::Point topLeft(cvRound((left - mBoardOrigin.x)*mPixelsPerUnit), cvRound((top - mBoardOrigin.y)*mPixelsPerUnit));
+        marker.copyTo(mBoardImage(cv::Rect(topLeft, marker.size())));
+    }
+}
+
+void SyntheticBoard::updateNormalizedMap(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, cv::Size imageSize)
+{
+    if(mNormalizedMap.size() == imageSize && cv::norm(cameraMatrix, mMapCameraMatrix, cv::NORM_INF) == 0 &&
+            cv::norm(distCoeffs, mMapDistCoeffs, cv::NORM_INF) == 0)
+        return;
+
+    cv::Mat pixels(1, imageSize.area(), CV_32FC2);
+    cv::Point2f* pixelsPtr = pixels.ptr<cv::Point2f>();
+    for(int i = 0; i < imageSize.height; i++)
+        for(int j = 0; j < imageSize.width; j++)
+            *pixelsPtr++ = cv::Point2f((float)j, (float)i);
+
+    cv::undistortPoints(pixels, mNormalizedMap, cameraMatrix, distCoeffs);
+    mNormalizedMap = mNormalizedMap.reshape(2, imageSize.height);
+    mMapCameraMatrix = cameraMatrix.clone();
+    mMapDistCoeffs = distCoeffs.clone();
+}
+
+void SyntheticBoard::generatePose(const cv::Mat &cameraMatrix, cv::Size imageSize, cv::Mat &rvec, cv::Mat &tvec)
+{
+    rvec = (cv::Mat_<double>(3, 1) << mRng.uniform(-MAX_TILT_ANGLE*1., MAX_TILT_ANGLE*1.),
+                                      mRng.uniform(-MAX_TILT_ANGLE*1., MAX_TILT_ANGLE*1.),
+                                      mRng.uniform(-MAX_ROLL_ANGLE*1., MAX_ROLL_ANGLE*1.));
+    rvec *= CV_PI / 180;
+
+    double fill = mRng.uniform(0.35, 0.6);
+    double distance = cameraMatrix.at<double>(0, 0) * mExtent / (fill * std::min(imageSize.width, imageSize.height));
+    cv::Mat centerPixel = (cv::Mat_<double>(3, 1) << mRng.uniform(0.35, 0.65)*imageSize.width,
+                                                     mRng.uniform(0.35, 0.65)*imageSize.height, 1);
+    cv::Mat R, center = (cv::Mat_<double>(3, 1) << mCenter.x, mCenter.y, mCenter.z);
+    cv::Rodrigues(rvec, R);
+    tvec = distance*cameraMatrix.inv()*centerPixel - R*center;
+}
+
+void SyntheticBoard::projectView(const cv::Mat &rvec, const cv::Mat &tvec, const cv::Mat &cameraMatrix,
+                                 const cv::Mat &distCoeffs, double noiseSigma, std::vector<cv::Point2f> &imagePoints)
+{
+    cv::projectPoints(mObjectPoints, rvec, tvec, cameraMatrix, distCoeffs, imagePoints);
+    if(noiseSigma > 0)
+        for(cv::Point2f& point : imagePoints) {
+            point.x += (float)mRng.gaussian(noiseSigma);
+            point.y += (float)mRng.gaussian(noiseSigma);
+        }
+}
+
+void SyntheticBoard::renderView(const cv::Mat &rvec, const cv::Mat &tvec, const cv::Mat &cameraMatrix,
+                                const cv::Mat &distCoeffs, cv::Size imageSize, cv::Mat &frame)
+{
+    updateNormalizedMap(cameraMatrix, distCoeffs, imageSize);
+
+    // normalized image point -> board plane -> board raster pixel
+    cv::Mat R;
+    cv::Rodrigues(rvec, R);
+    cv::Mat planeToCamera(3, 3, CV_64F);
+    R.col(0).copyTo(planeToCamera.col(0));
+    R.col(1).copyTo(planeToCamera.col(1));
+    tvec.reshape(1, 3).convertTo(planeToCamera.col(2), CV_64F);
+    cv::Mat rasterToPlane = (cv::Mat_<double>(3, 3) << 1. / mPixelsPerUnit, 0, mBoardOrigin.x,
+                                                       0, 1. / mPixelsPerUnit, mBoardOrigin.y,
+                                                       0, 0, 1);
+    cv::Mat cameraToRaster = (planeToCamera*rasterToPlane).inv();
+
+    cv::Mat rasterMap, gray;
+    cv::perspectiveTransform(mNormalizedMap, rasterMap, cameraToRaster);
+    cv::remap(mBoardImage, gray, rasterMap, cv::noArray(), cv::INTER_LINEAR, cv::BORDER_CONSTANT,
+              cv::Scalar(BACKGROUND_COLOR));
+    cv::GaussianBlur(gray, gray, cv::Size(3, 3), 0.8);
+
+    cv::Mat noise(imageSize, CV_16SC1), noisyGray;
+    mRng.fill(noise, cv::RNG::NORMAL, 0, IMAGE_NOISE_SIGMA);
+    gray.convertTo(noisyGray, CV_16S);
+    noisyGray += noise;
+    noisyGray.convertTo(gray, CV_8U);
+    cv::cvtColor(gray, frame, cv::COLOR_GRAY2BGR);
+}
+
+cv::Mat SyntheticBoard::createCameraMatrix(cv::Size imageSize)
+{
+    double focal = 0.9*imageSize.width;
+    return (cv::Mat_<double>(3, 3) << focal, 0, 0.5*(imageSize.width - 1),
+                                      0, focal, 0.5*(imageSize.height - 1),
+                                      0, 0, 1);
+}
+
+cv::Mat SyntheticBoard::createDistCoeffs()
+{
+    return (cv::Mat_<double>(1, 5) << -0.12, 0.05, 5e-4, -5e-4, 0);
+}
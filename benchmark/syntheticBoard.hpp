@@ -0,0 +1,54 @@
+#ifndef SYNTHETIC_BOARD_HPP
+#define SYNTHETIC_BOARD_HPP
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+#include "calibCommon.hpp"
+
+namespace calib
+{
+
+// Renders a calibration template or projects its points under known camera parameters.
+// The board raster shares the coordinates of the board model, so detected points can be
+// compared with the projected ones.
+class SyntheticBoard
+{
+protected:
+    TemplateType mBoardType;
+    std::vector<cv::Point3f> mObjectPoints;
+    cv::Point3f mCenter;
+    float mExtent;
+
+    cv::Mat mBoardImage;
+    cv::Point2f mBoardOrigin;
+    float mPixelsPerUnit;
+
+    cv::Mat mNormalizedMap;
+    cv::Mat mMapCameraMatrix;
+    cv::Mat mMapDistCoeffs;
+
+    cv::RNG mRng;
+
+    void renderChessboard(cv::Size boardSize, float squareSize);
+    void renderCircles(cv::Size boardSize, float squareSize, bool isDual);
+    void renderChAruco(const captureParameters& params);
+    void updateNormalizedMap(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, cv::Size imageSize);
+
+public:
+    SyntheticBoard(const captureParameters& params, const std::vector<cv::Point3f>& objectPoints,
+                   uint64 seed = 0x12345678);
+
+    void generatePose(const cv::Mat& cameraMatrix, cv::Size imageSize, cv::Mat& rvec, cv::Mat& tvec);
+    void projectView(const cv::Mat& rvec, const cv::Mat& tvec, const cv::Mat& cameraMatrix,
+                     const cv::Mat& distCoeffs, double noiseSigma, std::vector<cv::Point2f>& imagePoints);
+    void renderView(const cv::Mat& rvec, const cv::Mat& tvec, const cv::Mat& cameraMatrix,
+                    const cv::Mat& distCoeffs, cv::Size imageSize, cv::Mat& frame);
+
+    static cv::Mat createCameraMatrix(cv::Size imageSize);
+    static cv::Mat createDistCoeffs();
+};
+
+}
+
+#endif
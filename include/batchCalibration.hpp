@@ -0,0 +1,52 @@
+#ifndef BATCH_CALIBRATION_HPP
+#define BATCH_CALIBRATION_HPP
+
+#include <opencv2/core.hpp>
+#include <string>
+#include <vector>
+
+#include "calibCommon.hpp"
+#include "calibController.hpp"
+
+namespace calib
+{
+
+// Off-line calibration over a set of images: the boards are detected by a pool of threads,
+// then the camera is calibrated once. No HighGUI windows are created.
+class BatchCalibration
+{
+protected:
+    struct imageDetection
+    {
+        bool isFound = false;
+        cv::Size imageSize;
+        std::vector<cv::Point2f> imagePoints;
+        std::vector<int> pointIds;
+    };
+
+    captureParameters mCaptureParams;
+    Sptr<calibrationData> mCalibData;
+    Sptr<calibDataController> mDataController;
+    int mCalibFlags;
+    cv::TermCriteria mTermCrit;
+    double mLossScale;
+    std::string mJournalFileName;
+
+    std::vector<std::string> getImageNames() const;
+    void detectTemplates(const std::vector<std::string>& imageNames, std::vector<imageDetection>& detections);
+    bool calibrate();
+public:
+    BatchCalibration(const captureParameters& params, Sptr<calibrationData> data,
+                     Sptr<calibDataController> dataController, int calibFlags, cv::TermCriteria termCrit,
+                     double lossScale = 1.);
+
+    // the accepted views are written to the journal
+    void setJournalFileName(const std::string& fileName);
+    bool run();
+    // solves the views of a session journal instead of detecting boards
+    bool replay(const std::string& journalFileName);
+};
+
+}
+
+#endif
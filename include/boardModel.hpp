@@ -0,0 +1,27 @@
+#ifndef BOARD_MODEL_HPP
+#define BOARD_MODEL_HPP
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+namespace calib
+{
+
+// Object points of a calibration board, built once and shared by all captured views.
+// Views refer to these points by index.
+class BoardModel
+{
+protected:
+    std::vector<cv::Point3f> mPoints;
+
+public:
+    BoardModel(const std::vector<cv::Point3f>& points);
+
+    size_t getPointsNumber() const;
+    const cv::Point3f& getPoint(int id) const;
+    const std::vector<cv::Point3f>& getPoints() const;
+};
+
+}
+
+#endif
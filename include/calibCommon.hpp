@@ -2,16 +2,25 @@
 #define CALIB_COMMON_HPP
 
 #include <memory>
+#include <mutex>
 #include <opencv2/core.hpp>
 #include <vector>
 
+#include "coverageIndex.hpp"
+#include "pointStore.hpp"
+#include "sessionJournal.hpp"
+#include "undistortMap.hpp"
+
 namespace calib
 {
     #define OVERLAY_DELAY 1000
     #define IMAGE_MAX_WIDTH 1280
     #define IMAGE_MAX_HEIGHT 960
+    #define OVERLAY_TEXT_SIZE 4
 
     bool showOverlayMessage(const std::string& message);
+    // frames wider than previewWidth are shown downscaled, detection keeps the full size
+    cv::Size getPreviewSize(cv::Size imageSize, int previewWidth);
 
     enum class InputType { Video, Pictures };
     enum class InputVideoSource { Camera, File };
@@ -38,13 +47,15 @@ namespace calib
         double totalAvgErr;
         cv::Size imageSize = cv::Size(IMAGE_MAX_WIDTH, IMAGE_MAX_HEIGHT);
 
-        std::vector<std::vector<cv::Point2f>> imagePoints;
-        std::vector< std::vector<cv::Point3f>> objectPoints;
-
-        std::vector<cv::Mat> allCharucoCorners;
-        std::vector<cv::Mat> allCharucoIds;
+        PointStore points;
+        // accepted and removed views are logged here when a journal is open
+        std::shared_ptr<SessionJournal> journal;
 
-        cv::Mat undistMap1, undistMap2;
+        UndistortMap undistortMap;
+        unsigned removalsCount = 0;
+        CoverageIndex coverage;
+        // guards the captured views while frame processors run concurrently
+        std::mutex pointsMutex;
     };
 
     struct cameraParameters
@@ -73,12 +84,18 @@ namespace calib
         float squareSize;
         float templDst;
         std::string videoFileName;
+        std::string imagesPattern;
         bool flipVertical;
         int camID;
         int fps = 30;
         cv::Size cameraResolution = cv::Size(IMAGE_MAX_WIDTH, IMAGE_MAX_HEIGHT);
         int maxFramesNum = 30;
         int minFramesNum = 10;
+        int processingThreads = 0;
+        bool boardTracking = false;
+        bool boardPrecheck = false;
+        bool motionGate = false;
+        int previewWidth = 0;
     };
 
     struct internalParameters
@@ -86,7 +103,15 @@ namespace calib
         double solverEps = 1e-7;
         int solverMaxIters = 30;
         bool fastSolving = false;
+        bool schurSolving = false;
+        bool choleskySolving = false;
+        bool incrementalSolving = false;
+        bool parallelTuning = false;
+        // 0 - least squares, 1 - Huber, 2 - Cauchy
+        int robustLoss = 0;
+        double robustLossScale = 1.;
         double filterAlpha = 0.1;
+        int coverageGridSize = 10;
     };
 
 template <typename T>
@@ -4,6 +4,7 @@
 #include "calibCommon.hpp"
 #include <stack>
 #include <string>
+#include <vector>
 #include <ostream>
 
 namespace calib {
@@ -15,10 +16,12 @@ namespace calib {
         int mCalibFlags;
         unsigned mMinFramesNum;
         bool mNeedTuning;
+        bool mParallelTuning;
         bool mConfIntervalsState;
         bool mCoverageQualityState;
 
-        double estimateCoverageQuality();
+        // flags of the parameters whose estimates are close enough to the fixed values
+        int getFixableFlags() const;
     public:
         calibController();
         calibController(Sptr<calibrationData> data, int initialFlags, bool autoTuning,
@@ -27,12 +30,23 @@ namespace calib {
         void updateState();
 
         bool getCommonCalibrationState() const;
+        // number of the calibration quality criteria which are not reached yet
+        int getUnmetCriteriaNumber() const;
 
         bool getFramesNumberState() const;
         bool getConfidenceIntrervalsState() const;
         bool getRMSState() const;
         bool getPointsCoverageState() const;
         int getNewFlags() const;
+
+        // instead of fixing one parameter per step, several flag sets are solved together
+        // and the best of them is adopted at once
+        void setParallelTuning(bool isEnabled);
+        std::vector<int> getCandidateFlags() const;
+        void setTunedFlags(int flags);
+
+        static bool checkConfidenceIntervals(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs,
+                                             const cv::Mat& stdDeviations);
     };
 
     class calibDataController
@@ -43,14 +57,16 @@ namespace calib {
         std::string mParamsFileName;
         unsigned mMaxFramesNum;
         double mAlpha;
+        int mPreviewWidth;
 
-        double estimateGridSubsetQuality(size_t excludedIndex);
+        void updateCoverageIndex();
     public:
         calibDataController(Sptr<calibrationData> data, int maxFrames, double convParameter);
         calibDataController();
 
         void filterFrames();
         void setParametersFileName(const std::string& name);
+        void setPreviewWidth(int width);
         void deleteLastFrame();
         void rememberCurrentParameters();
         void deleteAllData();
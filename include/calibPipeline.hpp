@@ -2,10 +2,14 @@
 #define CALIB_PIPELINE_HPP
 
 #include <vector>
+#include <atomic>
+#include <thread>
 #include <opencv2/highgui.hpp>
 
 #include "calibCommon.hpp"
+#include "calibWorker.hpp"
 #include "frameProcessor.hpp"
+#include "frameRingBuffer.hpp"
 
 namespace calib
 {
@@ -16,7 +20,11 @@ enum class PipelineExitStatus { Finished,
                                 DeleteAllFrames,
                                 SaveCurrentData,
                                 SwitchUndistort,
-                                SwitchVisualisation
+                                EnableUndistort,
+                                DisableUndistort,
+                                SwitchVisualisation,
+                                CalibrationReady,
+                                Continue
                               };
 
 class CalibPipeline
@@ -25,13 +33,30 @@ protected:
     captureParameters mCaptureParams;
     cv::Size mImageSize;
     cv::VideoCapture mCapture;
+    Sptr<CalibWorker> mCalibWorker;
 
-    cv::Size getCameraResolution();
+    FrameRingBuffer mFrames;
+    std::thread mCaptureThread;
+    std::atomic<bool> mStopCapture;
+    size_t mProcessedFrames;
+
+    void openCapture();
+    void captureFrames();
+    PipelineExitStatus processSequentially(std::vector<Sptr<FrameProcessor>>& processors);
+    PipelineExitStatus processPipelined(std::vector<Sptr<FrameProcessor>>& processors);
 
 public:
     CalibPipeline(captureParameters params);
+    ~CalibPipeline();
+    // opens the source ahead of start, so its image size is known before the first frame
+    void open();
     PipelineExitStatus start(std::vector<Sptr<FrameProcessor>> processors);
+    void setCalibWorker(Sptr<CalibWorker> worker);
     cv::Size getImageSize() const;
+
+    // opens the camera or the video file of params, the camera fps is stored back to params
+    static void openVideoCapture(cv::VideoCapture& capture, captureParameters& params);
+    static PipelineExitStatus getKeyStatus(int key);
 };
 
 }
@@ -0,0 +1,80 @@
+#ifndef CALIB_WORKER_HPP
+#define CALIB_WORKER_HPP
+
+#include <opencv2/core.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+#include "calibCommon.hpp"
+
+namespace calib
+{
+
+struct calibrationResult
+{
+    cv::Mat cameraMatrix;
+    cv::Mat distCoeffs;
+    cv::Mat stdDeviations;
+    cv::Mat perViewErrors;
+    std::vector<cv::Mat> rvecs;
+    std::vector<cv::Mat> tvecs;
+    double totalAvgErr = 0;
+    size_t framesNum = 0;
+    unsigned removalsCount = 0;
+    double calibrationTime = 0;
+    // set when the flags were chosen among several solved candidates
+    bool isTuned = false;
+    int flags = 0;
+    std::string errorMessage;
+};
+
+class CalibWorker
+{
+protected:
+    cv::TermCriteria mTermCrit;
+    double mLossScale;
+
+    PointStore mPoints;
+    cv::Size mImageSize;
+    cv::Mat mCameraMatrix;
+    cv::Mat mDistCoeffs;
+    std::vector<cv::Mat> mRvecs;
+    std::vector<cv::Mat> mTvecs;
+    int mFlags;
+    std::vector<int> mCandidateFlags;
+    unsigned mRemovalsCount;
+
+    calibrationResult mResult;
+    bool mHasTask;
+    bool mIsBusy;
+    bool mHasResult;
+    bool mStop;
+    unsigned mGeneration;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mThread;
+
+    void run();
+    // the packed points are only read, so several solves may share them
+    calibrationResult calibrate(int flags, const cv::Mat& objectPoints, const cv::Mat& imagePoints,
+                                const cv::Mat& npoints);
+    calibrationResult tune(const cv::Mat& objectPoints, const cv::Mat& imagePoints, const cv::Mat& npoints);
+public:
+    CalibWorker(cv::TermCriteria termCrit, double lossScale = 1.);
+    ~CalibWorker();
+
+    // with candidate flags every set is solved from the current solution and the best one is returned
+    bool requestCalibration(const calibrationData& data, int flags,
+                            const std::vector<int>& candidateFlags = std::vector<int>());
+    bool isBusy() const;
+    bool isResultReady() const;
+    bool fetchResult(calibrationResult& result);
+    void cancel();
+};
+
+}
+
+#endif
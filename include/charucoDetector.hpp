@@ -0,0 +1,37 @@
+#ifndef CHARUCO_DETECTOR_HPP
+#define CHARUCO_DETECTOR_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/aruco/charuco.hpp>
+#include <vector>
+
+namespace calib
+{
+
+// ChArUco detection state kept between frames: the detector parameters are created once and
+// the grayscale image is shared by the marker detection, refinement and corners interpolation.
+class CharucoDetector
+{
+protected:
+    cv::Ptr<cv::aruco::CharucoBoard> mBoard;
+    cv::Ptr<cv::aruco::Board> mMarkersBoard;
+    cv::Ptr<cv::aruco::Dictionary> mDictionary;
+    cv::Ptr<cv::aruco::DetectorParameters> mDetectorParams;
+
+    cv::Mat mGray;
+    std::vector<std::vector<cv::Point2f>> mMarkerCorners;
+    std::vector<std::vector<cv::Point2f>> mRejectedCandidates;
+    std::vector<int> mMarkerIds;
+
+public:
+    CharucoDetector(cv::Ptr<cv::aruco::CharucoBoard> board, cv::Ptr<cv::aruco::Dictionary> dictionary);
+
+    // returns the number of interpolated chessboard corners
+    int detect(const cv::Mat& frame, cv::Mat& charucoCorners, cv::Mat& charucoIds);
+    // draws the markers found by the last detect call
+    void drawMarkers(const cv::Mat& frame) const;
+};
+
+}
+
+#endif
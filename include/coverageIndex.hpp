@@ -0,0 +1,50 @@
+#ifndef COVERAGE_INDEX_HPP
+#define COVERAGE_INDEX_HPP
+
+#include <opencv2/core.hpp>
+#include <utility>
+#include <vector>
+
+#include "pointStore.hpp"
+
+namespace calib
+{
+
+// Points histogram over an image grid with running sums, so the quality of the whole
+// set and of the set without one view are both evaluated without revisiting the points.
+class CoverageIndex
+{
+protected:
+    int mGridSize;
+    cv::Size mImageSize;
+    std::vector<int> mPointsInCell;
+    std::vector<std::vector<std::pair<int, int>>> mViewCells;
+    double mCellsSum, mCellsSqSum;
+
+    int getCellIndex(float x, float y) const;
+    void addCells(std::vector<int>& cells);
+
+public:
+    CoverageIndex(int gridSize = 10);
+
+    void setGridSize(int gridSize);
+    void reset(cv::Size imageSize);
+    void rebuild(cv::Size imageSize, const PointStore& points);
+    void addView(const cv::Point2f* points, int pointsNum);
+    void removeView(size_t index);
+    void removeLastView();
+    void clear();
+
+    size_t getViewsNumber() const;
+    int getGridSize() const;
+    cv::Size getImageSize() const;
+    int getCellCount(int x, int y) const;
+    int getMaxCellCount() const;
+    cv::Rect getCellRect(int x, int y) const;
+    double getQuality() const;
+    double getQualityWithout(size_t index) const;
+};
+
+}
+
+#endif
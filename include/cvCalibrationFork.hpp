@@ -4,6 +4,7 @@
 #include <opencv2/core.hpp>
 #include <opencv2/aruco/charuco.hpp>
 #include <opencv2/calib3d.hpp>
+#include <chrono>
 
 namespace cvfork
 {
@@ -11,13 +12,43 @@ using namespace cv;
 
 #define CV_CALIB_NINTRINSIC 18
 #define CALIB_USE_QR (1 << 18)
+#define CALIB_USE_SCHUR (1 << 23)
+// the extrinsic guess is OpenCV's CALIB_USE_EXTRINSIC_GUESS, older releases only lack its name
+#if CV_VERSION_MAJOR >= 4
+#define CALIB_USE_INITIAL_EXTRINSICS cv::CALIB_USE_EXTRINSIC_GUESS
+#else
+#define CALIB_USE_INITIAL_EXTRINSICS (1 << 22)
+#endif
+#define CALIB_EXTRINSIC_STD_DEVIATIONS (1 << 25)
+#define CALIB_USE_CHOLESKY (1 << 26)
+// per-point robust loss, lossScale is the reprojection error in pixels where it departs from L2
+#define CALIB_ROBUST_HUBER (1 << 27)
+#define CALIB_ROBUST_CAUCHY (1 << 28)
+
+// timings and counts of the solver internals, the application sees them through the hooks
+enum SolverStage { SOLVER_STAGE_STEP, SOLVER_STAGE_JACOBIAN, SOLVER_STAGE_ERROR };
+enum SolverCounter { SOLVER_COUNTER_ITERATIONS, SOLVER_COUNTER_JACOBIANS };
+typedef std::chrono::high_resolution_clock SolverClock;
+typedef void (*SolverStageHook)(SolverStage stage, SolverClock::time_point startPoint, SolverClock::time_point endPoint);
+typedef void (*SolverCounterHook)(SolverCounter counter, long long value);
+// null hooks switch the reporting off, the stages are not timed then
+void setSolverHooks(SolverStageHook stageHook, SolverCounterHook counterHook);
 
 double calibrateCamera(InputArrayOfArrays objectPoints,
                                      InputArrayOfArrays imagePoints, Size imageSize,
                                      InputOutputArray cameraMatrix, InputOutputArray distCoeffs,
                                      OutputArrayOfArrays rvecs, OutputArrayOfArrays tvecs, OutputArray stdDeviations,
                                      OutputArray perViewErrors, int flags = 0, TermCriteria criteria = TermCriteria(
-                                        TermCriteria::COUNT + TermCriteria::EPS, 30, DBL_EPSILON) );
+                                        TermCriteria::COUNT + TermCriteria::EPS, 30, DBL_EPSILON),
+                                     double lossScale = 1. );
+
+// the same as calibrateCamera, but the points of all views are already packed one after another
+double calibrateCameraPacked(InputArray objectPoints, InputArray imagePoints, InputArray npoints, Size imageSize,
+                             InputOutputArray cameraMatrix, InputOutputArray distCoeffs,
+                             OutputArrayOfArrays rvecs, OutputArrayOfArrays tvecs, OutputArray stdDeviations,
+                             OutputArray perViewErrors, int flags = 0, TermCriteria criteria = TermCriteria(
+                                TermCriteria::COUNT + TermCriteria::EPS, 30, DBL_EPSILON),
+                             double lossScale = 1. );
 
 double cvCalibrateCamera2( const CvMat* object_points,
                                 const CvMat* image_points,
@@ -31,7 +62,8 @@ double cvCalibrateCamera2( const CvMat* object_points,
                                 CvMat* perViewErrors_vector CV_DEFAULT(NULL),
                                 int flags CV_DEFAULT(0),
                                 CvTermCriteria term_crit CV_DEFAULT(cvTermCriteria(
-                                    CV_TERMCRIT_ITER+CV_TERMCRIT_EPS,30,DBL_EPSILON)) );
+                                    CV_TERMCRIT_ITER+CV_TERMCRIT_EPS,30,DBL_EPSILON)),
+                                double loss_scale CV_DEFAULT(1.) );
 
 double calibrateCameraCharuco(InputArrayOfArrays _charucoCorners, InputArrayOfArrays _charucoIds,
                               Ptr<aruco::CharucoBoard> &_board, Size imageSize,
@@ -40,6 +72,13 @@ double calibrateCameraCharuco(InputArrayOfArrays _charucoCorners, InputArrayOfAr
                               int flags = 0, TermCriteria criteria = TermCriteria(
                                     TermCriteria::COUNT + TermCriteria::EPS, 30, DBL_EPSILON) );
 
+// compares the derivatives of the projection the solver selects for flags with central differences of
+// the same projection, for the parameters flags leave free, and the projection itself with projectPoints.
+// Returns the largest derivative error relative to max(1, |derivative|), projectionError receives the
+// largest distance in pixels
+double checkProjectionKernel(InputArray objectPoints, InputArray rvec, InputArray tvec, InputArray cameraMatrix,
+                             InputArray distCoeffs, int flags, double& projectionError);
+
 class CvLevMarqFork : public CvLevMarq
 {
 public:
@@ -48,7 +87,17 @@ public:
               bool completeSymmFlag=false );
     bool updateAlt( const CvMat*& _param, CvMat*& _JtJ, CvMat*& _JtErr, double*& _errNorm );
     void step();
+    // params are [nintrinsic shared | 6 per view]: eliminate views with Schur complement
+    void enableSchurComplement(int nintrinsic);
     ~CvLevMarqFork();
+protected:
+    int schurIntrinsic;
+    // workspace of the Schur step, reused between the iterations
+    std::vector<int> schurIdx;
+    std::vector<Matx66d> schurVinv;
+    Mat_<double> schurS, schurG, schurDx, schurW, schurY;
+    bool stepSchur();
+    void solveSystem(const cv::Mat& A, const cv::Mat& b, cv::Mat& x) const;
 };
 }
 
@@ -0,0 +1,91 @@
+#ifndef DISPLAY_HPP
+#define DISPLAY_HPP
+
+#include <opencv2/core.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace calib
+{
+
+// a checkbox posts its key with one of these bits, so its state is applied and not toggled
+#define BUTTON_CHECKED_KEY (1 << 24)
+#define BUTTON_UNCHECKED_KEY (1 << 25)
+
+// Owns every HighGUI call. Frames are presented by a separate thread at most DISPLAY_MAX_FPS
+// times per second and a newer frame replaces the pending one, so the senders never wait for
+// the screen. Key presses and control panel buttons are queued and polled without blocking.
+class Display
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+protected:
+    enum class commandType { NewWindow, RemoveWindow, NewButton, Overlay };
+
+    struct windowCommand
+    {
+        commandType type;
+        std::string name;
+        std::string text;
+        cv::Point position;
+        int key = 0;
+        int buttonType = 0;
+        bool buttonState = false;
+        int delay = 0;
+    };
+
+    struct windowFrame
+    {
+        std::string name;
+        cv::Mat frame;
+        bool isNew = false;
+        std::string message;
+        clock::time_point messageUntil;
+    };
+
+    std::vector<windowFrame> mWindows;
+    std::deque<windowCommand> mCommands;
+    std::deque<int> mKeys;
+    bool mIsRunning;
+    bool mStop;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mThread;
+
+    Display();
+    void run();
+    void pushCommand(const windowCommand& command);
+    windowFrame& getWindow(const std::string& name);
+    bool hasNewFrames() const;
+public:
+    static Display& instance();
+    ~Display();
+
+    void start();
+    void stop();
+    bool isRunning();
+
+    void createWindow(const std::string& name, cv::Point position);
+    void destroyWindow(const std::string& name);
+    // pressing the button posts key, a checkbox posts it with its new state on every switch
+    void createButton(const std::string& name, int key, int buttonType, bool initialState = false);
+    void showOverlay(const std::string& name, const std::string& text, int delay);
+    void show(const std::string& name, const cv::Mat& frame);
+    // the message is drawn over the frames of the window presented in the next duration milliseconds,
+    // the frames themselves are not changed
+    void showMessage(const std::string& name, const std::string& message, int duration);
+
+    void postKey(int key);
+    // -1 when no key was pressed
+    int pollKey();
+};
+
+}
+
+#endif
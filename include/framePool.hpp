@@ -0,0 +1,31 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <opencv2/core.hpp>
+#include <mutex>
+#include <vector>
+
+namespace calib
+{
+
+// Output buffers that are reused once nobody refers to them anymore, so frames still
+// waiting downstream are never overwritten.
+class FramePool
+{
+protected:
+    std::vector<cv::Mat> mBuffers;
+    size_t mMaxBuffersNum;
+    std::mutex mMutex;
+
+public:
+    FramePool(size_t maxBuffersNum);
+
+    cv::Mat acquire(cv::Size size, int type);
+    void clear();
+
+    static bool isShared(const cv::Mat& frame);
+};
+
+}
+
+#endif
@@ -4,8 +4,11 @@
 #include <opencv2/core.hpp>
 #include <opencv2/aruco/charuco.hpp>
 #include <opencv2/calib3d.hpp>
+#include <atomic>
 #include "calibCommon.hpp"
 #include "calibController.hpp"
+#include "framePool.hpp"
+#include "charucoDetector.hpp"
 
 namespace calib
 {
@@ -18,6 +21,8 @@ public:
     virtual cv::Mat processFrame(const cv::Mat& frame) = 0;
     virtual bool isProcessed() const = 0;
     virtual void resetState() = 0;
+    // stateless processors may process several frames concurrently
+    virtual bool isStateless() const;
 };
 
 class CalibProcessor : public FrameProcessor
@@ -34,31 +39,73 @@ protected:
     cv::Ptr<cv::SimpleBlobDetector> mBlobDetectorPtr;
     cv::Ptr<cv::aruco::Dictionary> mArucoDictionary;
     cv::Ptr<cv::aruco::CharucoBoard> mCharucoBoard;
+    Sptr<CharucoDetector> mCharucoDetector;
 
     int mNeededFramesNum;
     unsigned mDelayBetweenCaptures;
-    int mCapuredFrames;
+    // read by the pipeline thread while the processing stage counts the captures
+    std::atomic<int> mCapuredFrames;
     float mMaxTemplateOffset;
     float mSquareSize;
     float mTemplDist;
-
-    bool detectAndParseChessboard(const cv::Mat& frame);
-    bool detectAndParseChAruco(const cv::Mat& frame);
-    bool detectAndParseACircles(const cv::Mat& frame);
-    bool detectAndParseDualACircles(const cv::Mat& frame);
+    bool mBoardTracking;
+    cv::Rect mTrackedRegion;
+    int mFramesSinceFullSearch;
+
+    // grayscale version of the current frame and its pyramid levels, shared by all detectors
+    cv::Mat mGrayFrame;
+    cv::Mat mGrayBuffer;
+    std::vector<cv::Mat> mGrayPyramid;
+    int mPyramidLevelsNum;
+
+    // cheap rejection of frames without a board or with a board moving too fast
+    bool mBoardPrecheck;
+    bool mMotionGate;
+    std::vector<cv::KeyPoint> mPrecheckKeypoints;
+    cv::Mat mMotionFrame;
+    cv::Mat mLastMotionFrame;
+    cv::Mat mMotionWindow;
+
+    // pose of the last checked view, the pose of the next capture is refined from it
+    cv::Mat mLastRvec;
+    cv::Mat mLastTvec;
+    std::vector<cv::Point3f> mPoseObjectPoints;
+    std::vector<cv::Point2f> mPoseProjections;
+    cv::Mat mPoseJacobian;
+
+    void prepareFrame(const cv::Mat& frame);
+    cv::Mat getPyramidLevel(int level);
+    bool passesPrecheck();
+    // detections are drawn into frame unless it is empty
+    bool detectAndParseChessboard(const cv::Mat& frame, const cv::Mat& gray);
+    bool detectAndParseChAruco(const cv::Mat& frame, const cv::Mat& gray);
+    bool detectAndParseACircles(const cv::Mat& frame, const cv::Mat& gray);
+    bool detectAndParseDualACircles(const cv::Mat& frame, const cv::Mat& gray);
+    bool detectAndParseTemplate(const cv::Mat& frame, const cv::Mat& gray);
+    bool detectInRegion(const cv::Mat& frame, const cv::Rect& region);
+    bool detectWithTracking(const cv::Mat& frame);
+    cv::Rect getCurrentTemplateRegion(double scale, double margin) const;
+    cv::Point2f getCurrentTemplateLocation() const;
+    std::vector<cv::Point3f> createBoardPoints() const;
     void saveFrameData();
-    void showCaptureMessage(const cv::Mat &frame, const std::string& message);
+    bool saveAndCheckFrame(cv::Size imageSize);
+    void showCaptureMessage(const std::string& message);
     bool checkLastFrame();
+    void estimateLastViewPose(const cv::Mat& cameraMatrix, bool isCalibrated, cv::Mat& rvec, cv::Mat& tvec);
 
 public:
     CalibProcessor(Sptr<calibrationData> data, captureParameters& capParams);
     virtual cv::Mat processFrame(const cv::Mat& frame) override;
     virtual bool isProcessed() const override;
     virtual void resetState() override;
+
+    // detection and storing of still images, without capture timing and GUI
+    bool detectTemplate(const cv::Mat& image, std::vector<cv::Point2f>& imagePoints, std::vector<int>& pointIds);
+    bool addView(cv::Size imageSize, const std::vector<cv::Point2f>& imagePoints, const std::vector<int>& pointIds);
     ~CalibProcessor();
 };
 
-enum class visualisationMode {Grid, Window};
+enum class visualisationMode {Grid, HeatMap, Window};
 
 class ShowProcessor : public FrameProcessor
 {
@@ -69,20 +116,37 @@ protected:
     visualisationMode mVisMode;
     bool mNeedUndistort;
     double mGridViewScale;
-    double mTextSize;
-
-    void drawBoard(cv::Mat& img, cv::InputArray& points);
-    void drawGridPoints(const cv::Mat& frame);
+    int mPreviewWidth;
+    FramePool mFramePool;
+
+    // pre-rendered captured points or heat map, re-rendered only after the views change;
+    // guarded by the points mutex
+    cv::Mat mOverlay;
+    cv::Mat mOverlayMask;
+    bool mIsOverlayValid;
+    unsigned long long mOverlayRevision;
+    visualisationMode mOverlayMode;
+    cv::Size mOverlaySize;
+
+    void drawBoard(cv::Mat& img, cv::InputArray& points, double scale);
+    void drawGridPoints(cv::Mat& overlay, double scale);
+    bool drawCoverageHeatMap(cv::Mat& overlay, cv::Size frameSize);
+    void getOverlay(cv::Size frameSize, cv::Size previewSize, cv::Mat& overlay, cv::Mat& overlayMask);
+    cv::Mat getPreview(const cv::Mat& frame);
+    void drawOverlay(const cv::Mat& frame, const cv::Mat& overlay, const cv::Mat& overlayMask);
 public:
     ShowProcessor(Sptr<calibrationData> data, Sptr<calibController> controller, TemplateType board);
     virtual cv::Mat processFrame(const cv::Mat& frame) override;
     virtual bool isProcessed() const override;
     virtual void resetState() override;
+    virtual bool isStateless() const override;
 
     void setVisualizationMode(visualisationMode mode);
     void switchVisualizationMode();
     void clearBoardsView();
     void updateBoardsView();
+    // 0 keeps the preview at capture resolution
+    void setPreviewWidth(int width);
 
     void switchUndistort();
     void setUndistort(bool isEnabled);
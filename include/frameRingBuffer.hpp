@@ -0,0 +1,39 @@
+#ifndef FRAME_RING_BUFFER_HPP
+#define FRAME_RING_BUFFER_HPP
+
+#include <opencv2/core.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace calib
+{
+
+enum class FrameDropPolicy { DropOldest, Block };
+
+// Frames are exchanged by swap, so the slot buffers are allocated once and then circulate.
+// DropOldest hands out only the newest frame, Block keeps every frame in order.
+class FrameRingBuffer
+{
+protected:
+    std::vector<cv::Mat> mSlots;
+    size_t mHead;
+    size_t mCount;
+    FrameDropPolicy mPolicy;
+    bool mIsClosed;
+    std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+
+public:
+    FrameRingBuffer(size_t slotsNum, FrameDropPolicy policy);
+
+    bool push(cv::Mat& frame);
+    bool pop(cv::Mat& frame, bool wait = true);
+    void close();
+    void clear();
+};
+
+}
+
+#endif
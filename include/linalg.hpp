@@ -7,6 +7,8 @@ namespace cvfork {
 
 double invert( cv::InputArray _src, cv::OutputArray _dst, int method );
 bool solve(cv::InputArray _src, cv::InputArray _src2arg, cv::OutputArray _dst, int method );
+// solves a symmetric positive-definite system, returns false if the factorization fails
+bool solveCholesky(cv::InputArray _src, cv::InputArray _src2arg, cv::OutputArray _dst);
 
 }
 
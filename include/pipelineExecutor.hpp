@@ -0,0 +1,63 @@
+#ifndef PIPELINE_EXECUTOR_HPP
+#define PIPELINE_EXECUTOR_HPP
+
+#include <opencv2/core.hpp>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "calibCommon.hpp"
+#include "frameProcessor.hpp"
+
+namespace calib
+{
+
+class OrderedFrameQueue
+{
+protected:
+    std::map<size_t, cv::Mat> mFrames;
+    size_t mNextIndex;
+    bool mIsClosed;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+
+public:
+    OrderedFrameQueue();
+    void push(size_t index, const cv::Mat& frame);
+    bool pop(size_t& index, cv::Mat& frame, bool wait = true);
+    void close();
+};
+
+// Runs every FrameProcessor as a separate stage, so consecutive frames are processed
+// by different stages at the same time. Stateless processors get several workers.
+class PipelineExecutor
+{
+protected:
+    std::vector<Sptr<FrameProcessor>> mProcessors;
+    std::vector<Sptr<OrderedFrameQueue>> mQueues;
+    std::vector<std::thread> mWorkers;
+    size_t mMaxFramesInFlight;
+    size_t mFramesInFlight;
+    size_t mSubmittedFrames;
+    size_t mFirstFrameNumber;
+    std::mutex mMutex;
+
+    void runStage(size_t stage);
+public:
+    PipelineExecutor(const std::vector<Sptr<FrameProcessor>>& processors, unsigned statelessWorkers,
+                     size_t maxFramesInFlight, size_t firstFrameNumber = 0);
+    ~PipelineExecutor();
+
+    // false when maxFramesInFlight frames are already in the pipeline, the results are
+    // collected by the caller, so it never waits here
+    bool trySubmit(const cv::Mat& frame);
+    bool getResult(cv::Mat& frame, bool wait);
+    void drain();
+    size_t getSubmittedFramesNum() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef POINT_STORE_HPP
+#define POINT_STORE_HPP
+
+#include <opencv2/core.hpp>
+#include <memory>
+#include <vector>
+
+#include "boardModel.hpp"
+
+namespace calib
+{
+
+// Points of all captured views are kept in contiguous arrays, so the solver reads them
+// without repacking. Each image point keeps the id of its board model point.
+// Views removed from the middle leave holes that are squeezed out once they outweigh
+// the live points.
+class PointStore
+{
+protected:
+    struct viewRecord
+    {
+        size_t offset;
+        int pointsNum;
+    };
+
+    std::shared_ptr<const BoardModel> mBoard;
+    std::vector<cv::Point2f> mImagePoints;
+    std::vector<int> mPointIds;
+    std::vector<viewRecord> mViews;
+    size_t mLivePointsNum;
+    unsigned long long mRevision;
+    std::vector<cv::Point3f> mPackedObjectPoints;
+
+    void compact();
+    void trimTail();
+
+public:
+    PointStore();
+
+    void setBoardModel(std::shared_ptr<const BoardModel> board);
+    std::shared_ptr<const BoardModel> getBoardModel() const;
+
+    // every point of the board model is visible
+    void addView(cv::InputArray imagePoints);
+    void addView(cv::InputArray imagePoints, cv::InputArray pointIds);
+    void removeView(size_t index);
+    void removeLastView();
+    void clear();
+
+    bool empty() const;
+    size_t getViewsNumber() const;
+    size_t getTotalPointsNumber() const;
+    // changes whenever views are added or removed
+    unsigned long long getRevision() const;
+    int getPointsNumber(size_t index) const;
+    const cv::Point2f* getImagePoints(size_t index) const;
+    const int* getPointIds(size_t index) const;
+    cv::Mat getImagePointsMat(size_t index) const;
+    void getObjectPoints(size_t index, std::vector<cv::Point3f>& objectPoints) const;
+
+    // headers over the internal arrays, valid until the store is modified
+    void getPacked(cv::Mat& objectPoints, cv::Mat& imagePoints, cv::Mat& npoints);
+};
+
+}
+
+#endif
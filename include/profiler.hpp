@@ -0,0 +1,104 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace calib
+{
+
+enum class ProfileStage { Capture, Flip, Grayscale, Precheck, DetectChessboard, DetectChAruco, DetectACircles, DetectDualACircles,
+                          CornerSubPix, PoseCheck, Remap, Drawing, Downscale, SolverJacobian, SolverError, SolverStep,
+                          Calibration, UndistortMap, FilterFrames, StagesNum };
+
+enum class ProfileCounter { GrabbedFrames, ProcessedFrames, SolverIterations, JacobianEvaluations, CountersNum };
+
+// Session-wide timings of the hot paths. While disabled a timer costs one atomic load.
+// Every thread collects its samples in its own buffer, the trace events are moved to the
+// bounded session trace in batches. Trace events carry the number of the frame the calling
+// thread works on: capture events are numbered by grabbed frames, processing events by
+// processed frames.
+class Profiler
+{
+public:
+    typedef std::chrono::high_resolution_clock clock;
+
+protected:
+    struct stageStats
+    {
+        size_t count = 0;
+        double total = 0;
+        double max = 0;
+    };
+
+    struct traceEvent
+    {
+        long long frame;
+        int stage;
+        unsigned thread;
+        double start;
+        double duration;
+    };
+
+    // samples of one thread, other threads only lock it to read them
+    struct threadBuffer
+    {
+        std::mutex mutex;
+        std::vector<stageStats> stats;
+        std::vector<traceEvent> trace;
+    };
+    struct threadBufferHolder;
+
+    std::atomic<bool> mIsEnabled;
+    std::atomic<bool> mIsTracing;
+    clock::time_point mStartPoint;
+    std::atomic<long long> mCounters[(size_t)ProfileCounter::CountersNum];
+    // the stats of the finished threads
+    std::vector<stageStats> mStats;
+    std::vector<traceEvent> mTrace;
+    size_t mDroppedEvents;
+    std::vector<std::shared_ptr<threadBuffer>> mBuffers;
+    mutable std::mutex mMutex;
+
+    Profiler();
+    threadBuffer& getThreadBuffer();
+    void releaseThreadBuffer(const std::shared_ptr<threadBuffer>& buffer);
+    // the callers hold mMutex
+    void appendTrace(const std::vector<traceEvent>& events);
+    void collectStats(std::vector<stageStats>& stats) const;
+    static void mergeStats(stageStats& dst, const stageStats& src);
+public:
+    static Profiler& instance();
+    static const char* getStageName(ProfileStage stage);
+    static void setCurrentFrame(long long frame);
+
+    void enable(bool withTrace);
+    bool isEnabled() const;
+    void addSample(ProfileStage stage, clock::time_point startPoint, clock::time_point endPoint);
+    void addCount(ProfileCounter counter, long long value = 1);
+
+    void printSummary(std::ostream& output) const;
+    // .json files get the Chrome trace event format, anything else CSV
+    bool writeTrace(const std::string& fileName) const;
+};
+
+class ScopedTimer
+{
+protected:
+    ProfileStage mStage;
+    bool mIsActive;
+    Profiler::clock::time_point mStartPoint;
+
+public:
+    ScopedTimer(ProfileStage stage);
+    ~ScopedTimer();
+};
+
+}
+
+#endif
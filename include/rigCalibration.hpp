@@ -0,0 +1,93 @@
+#ifndef RIG_CALIBRATION_HPP
+#define RIG_CALIBRATION_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "calibCommon.hpp"
+#include "calibController.hpp"
+#include "calibPipeline.hpp"
+#include "calibWorker.hpp"
+#include "frameProcessor.hpp"
+#include "frameRingBuffer.hpp"
+
+namespace calib
+{
+
+// Calibrates several cameras in one process. Every camera is captured by its own thread and
+// keeps its own calibration state and output file; the boards of all cameras are detected by
+// one pool of threads, and the solves are run one at a time, the camera furthest from a
+// complete calibration first.
+class RigCalibration
+{
+protected:
+    struct cameraSession
+    {
+        captureParameters params;
+        std::string windowName;
+        cv::VideoCapture capture;
+        cv::Size imageSize;
+        Sptr<FrameRingBuffer> frames;
+        std::thread captureThread;
+
+        Sptr<calibrationData> data;
+        Sptr<calibController> controller;
+        Sptr<calibDataController> dataController;
+        Sptr<CalibProcessor> calibProcessor;
+        Sptr<ShowProcessor> showProcessor;
+        Sptr<CalibWorker> worker;
+
+        // guarded by RigCalibration::mMutex
+        cv::Mat displayFrame;
+        bool isBusy = false;
+        bool isCalibrationPending = false;
+    };
+
+    captureParameters mCaptureParams;
+    internalParameters mInternalParams;
+    int mCalibFlags;
+    bool mAutoTuning;
+    cv::TermCriteria mTermCrit;
+    std::string mOutputFileName;
+
+    std::vector<Sptr<cameraSession>> mSessions;
+    std::vector<std::thread> mDetectionThreads;
+    std::atomic<bool> mStop;
+    std::atomic<int> mActiveCaptures;
+    std::atomic<long long> mProcessedFrames;
+    size_t mNextSession;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+
+    void openSession(int camID);
+    void captureFrames(cameraSession& session);
+    void detectFrames();
+    cameraSession* findReadySession(cv::Mat& frame);
+    // waits until no detection thread uses the session, then keeps it for the caller
+    void acquireSession(cameraSession& session);
+    void releaseSession(cameraSession& session);
+    void applyResult(cameraSession& session);
+    void scheduleCalibrations();
+    void processKey(PipelineExitStatus status);
+    void stop();
+public:
+    RigCalibration(const captureParameters& params, const internalParameters& intParams,
+                   int calibFlags, bool autoTuning, cv::TermCriteria termCrit,
+                   const std::string& outputFileName);
+    ~RigCalibration();
+
+    bool run(const std::vector<int>& cameraIds);
+
+    // cameraParameters.xml becomes cameraParameters_cam1.xml for the camera 1
+    static std::string getCameraFileName(const std::string& fileName, int camID);
+};
+
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SESSION_JOURNAL_HPP
+#define SESSION_JOURNAL_HPP
+
+#include <opencv2/core.hpp>
+#include <fstream>
+#include <string>
+
+#include "boardModel.hpp"
+#include "pointStore.hpp"
+
+namespace calib
+{
+
+// Binary log of the captured views. The header keeps the image size and the board model,
+// then every accepted or removed view is appended as a record, so a session can be resumed
+// or solved again off-line. The file is written in host byte order and read through mmap
+// where it is available. A record torn by a crash ends the replay.
+class SessionJournal
+{
+protected:
+    std::ofstream mStream;
+
+    void writeRecord(unsigned type, size_t index, int pointsNum, const cv::Point2f* points, const int* ids);
+public:
+    SessionJournal();
+    ~SessionJournal();
+
+    // starts the journal with the views already in the store, an existing file is replaced
+    bool open(const std::string& fileName, const PointStore& points, cv::Size imageSize);
+    bool isOpened() const;
+    void close();
+
+    void addView(const PointStore& points, size_t index);
+    void removeView(size_t index);
+    void clear();
+
+    // replays a journal into the store, which gets the board model of the journal;
+    // with requiredBoard set the journal is rejected unless it was taken with the same board
+    static bool load(const std::string& fileName, PointStore& points, cv::Size& imageSize,
+                     const BoardModel* requiredBoard = 0);
+    static uint64 getBoardHash(const BoardModel& board);
+};
+
+}
+
+#endif
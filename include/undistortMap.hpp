@@ -0,0 +1,53 @@
+#ifndef UNDISTORT_MAP_HPP
+#define UNDISTORT_MAP_HPP
+
+#include <opencv2/core.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace calib
+{
+
+// Remap tables for the undistorted view. New camera parameters are accepted only if they
+// move the map by a visible amount; the tables are then rebuilt in row tiles on a
+// background thread while the previous ones stay in use. Nothing is built while
+// the undistorted view is off.
+class UndistortMap
+{
+protected:
+    struct mapParameters
+    {
+        cv::Mat cameraMatrix;
+        cv::Mat distCoeffs;
+        cv::Mat newCameraMatrix;
+        cv::Size size;
+    };
+
+    cv::Mat mMap1, mMap2;
+    mapParameters mRequestedParams;
+    bool mHasRequest;
+    unsigned mRequestId;
+    bool mIsEnabled;
+    bool mStop;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mThread;
+
+    void run();
+    bool build(const mapParameters& params, unsigned requestId, cv::Mat& map1, cv::Mat& map2);
+    static double getMaxDisplacement(const mapParameters& first, const mapParameters& second);
+
+public:
+    UndistortMap();
+    ~UndistortMap();
+
+    // mapSize is the size of the undistorted image, the camera matrices are scaled to it
+    void update(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, cv::Size imageSize, cv::Size mapSize);
+    void setEnabled(bool isEnabled);
+    bool getMaps(cv::Mat& map1, cv::Mat& map2) const;
+};
+
+}
+
+#endif
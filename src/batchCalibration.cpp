@@ -0,0 +1,162 @@
+#include "batchCalibration.hpp"
+#include "frameProcessor.hpp"
+#include "cvCalibrationFork.hpp"
+#include "profiler.hpp"
+
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+using namespace calib;
+
+BatchCalibration::BatchCalibration(const captureParameters &params, Sptr<calibrationData> data,
+                                   Sptr<calibDataController> dataController, int calibFlags, cv::TermCriteria termCrit,
+                                   double lossScale) :
+    mCaptureParams(params), mCalibData(data), mDataController(dataController), mTermCrit(termCrit)
+{
+    mCalibFlags = calibFlags;
+    mLossScale = lossScale;
+}
+
+void BatchCalibration::setJournalFileName(const std::string &fileName)
+{
+    mJournalFileName = fileName;
+}
+
+std::vector<std::string> BatchCalibration::getImageNames() const
+{
+    std::vector<cv::String> names;
+    cv::glob(mCaptureParams.imagesPattern, names, false);
+    std::sort(names.begin(), names.end());
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+void BatchCalibration::detectTemplates(const std::vector<std::string> &imageNames,
+                                       std::vector<imageDetection> &detections)
+{
+    int threadsNum = mCaptureParams.processingThreads > 0 ? mCaptureParams.processingThreads :
+                                                            (int)std::max(std::thread::hardware_concurrency(), 1u);
+    threadsNum = std::min(threadsNum, (int)std::max(imageNames.size(), (size_t)1));
+    detections.assign(imageNames.size(), imageDetection());
+    std::atomic<size_t> nextImage(0);
+
+    // every thread owns a processor, detectors are not shared between threads
+    auto detectionWorker = [&]() {
+        Sptr<calibrationData> threadData(new calibrationData);
+        CalibProcessor processor(threadData, mCaptureParams);
+        for(size_t i = nextImage++; i < imageNames.size(); i = nextImage++) {
+            Profiler::setCurrentFrame((long long)i);
+            cv::Mat image;
+            {
+                ScopedTimer timer(ProfileStage::Capture);
+                image = cv::imread(imageNames[i]);
+            }
+            if(image.empty())
+                continue;
+            Profiler::instance().addCount(ProfileCounter::ProcessedFrames);
+            if(mCaptureParams.flipVertical) {
+                ScopedTimer timer(ProfileStage::Flip);
+                cv::flip(image, image, -1);
+            }
+            detections[i].imageSize = image.size();
+            detections[i].isFound = processor.detectTemplate(image, detections[i].imagePoints, detections[i].pointIds);
+        }
+    };
+
+    // the images are processed in parallel already, so keep OpenCV from spawning threads inside each detector
+    int openCVThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threadsNum; i++)
+        workers.push_back(std::thread(detectionWorker));
+    for(auto& worker : workers)
+        worker.join();
+    cv::setNumThreads(openCVThreads);
+}
+
+bool BatchCalibration::run()
+{
+    std::vector<std::string> imageNames = getImageNames();
+    if(imageNames.empty()) {
+        std::cout << "No images found for " << mCaptureParams.imagesPattern << std::endl;
+        return false;
+    }
+
+    using namespace std::chrono;
+    auto startPoint = high_resolution_clock::now();
+    std::vector<imageDetection> detections;
+    detectTemplates(imageNames, detections);
+    auto detectionPoint = high_resolution_clock::now();
+
+    CalibProcessor processor(mCalibData, mCaptureParams);
+    mCalibData->imageSize = cv::Size();
+    for(size_t i = 0; i < detections.size() && mCalibData->imageSize == cv::Size(); i++)
+        if(detections[i].isFound)
+            mCalibData->imageSize = detections[i].imageSize;
+    if(!mJournalFileName.empty()) {
+        mCalibData->journal = std::make_shared<SessionJournal>();
+        if(!mCalibData->journal->open(mJournalFileName, mCalibData->points, mCalibData->imageSize)) {
+            std::cout << "Unable to write journal " << mJournalFileName << std::endl;
+            mCalibData->journal.reset();
+        }
+    }
+    for(size_t i = 0; i < detections.size(); i++) {
+        if(!detections[i].isFound)
+            continue;
+        if(detections[i].imageSize != mCalibData->imageSize) {
+            std::cout << "Skipped " << imageNames[i] << ": image size differs from the first image" << std::endl;
+            continue;
+        }
+        if(!processor.addView(detections[i].imageSize, detections[i].imagePoints, detections[i].pointIds))
+            std::cout << "Skipped " << imageNames[i] << ": board orientation is not suitable" << std::endl;
+    }
+
+    std::cout << "Boards found in " << mCalibData->points.getViewsNumber() << " of " << imageNames.size()
+              << " images" << std::endl;
+    std::cout << "Detection time: " << duration_cast<duration<double>>(detectionPoint - startPoint).count() << "\n";
+    return calibrate();
+}
+
+bool BatchCalibration::replay(const std::string &journalFileName)
+{
+    cv::Size imageSize;
+    if(!SessionJournal::load(journalFileName, mCalibData->points, imageSize))
+        return false;
+    mCalibData->imageSize = imageSize;
+    std::cout << "Loaded " << mCalibData->points.getViewsNumber() << " views from " << journalFileName << std::endl;
+    return calibrate();
+}
+
+bool BatchCalibration::calibrate()
+{
+    if(mCalibData->points.getViewsNumber() < (size_t)mCaptureParams.minFramesNum) {
+        std::cout << "Not enough frames for calibration" << std::endl;
+        return false;
+    }
+
+    using namespace std::chrono;
+    auto startPoint = high_resolution_clock::now();
+    try {
+        ScopedTimer timer(ProfileStage::Calibration);
+        cv::Mat objectPoints, imagePoints, npoints;
+        mCalibData->points.getPacked(objectPoints, imagePoints, npoints);
+        mCalibData->totalAvgErr =
+                cvfork::calibrateCameraPacked(objectPoints, imagePoints, npoints, mCalibData->imageSize,
+                                              mCalibData->cameraMatrix, mCalibData->distCoeffs,
+                                              mCalibData->rvecs, mCalibData->tvecs, mCalibData->stdDeviations,
+                                              mCalibData->perViewErrors, mCalibFlags, mTermCrit, mLossScale);
+    }
+    catch(const cv::Exception& e) {
+        std::cout << e.what() << std::endl;
+        return false;
+    }
+    auto endPoint = high_resolution_clock::now();
+
+    mDataController->printParametersToConsole(std::cout);
+    std::cout << "Calibration time: " << duration_cast<duration<double>>(endPoint - startPoint).count() << "\n";
+
+    return mDataController->saveCurrentCameraParameters();
+}
@@ -0,0 +1,24 @@
+#include "boardModel.hpp"
+
+using namespace calib;
+
+BoardModel::BoardModel(const std::vector<cv::Point3f> &points) :
+    mPoints(points)
+{
+
+}
+
+size_t BoardModel::getPointsNumber() const
+{
+    return mPoints.size();
+}
+
+const cv::Point3f &BoardModel::getPoint(int id) const
+{
+    return mPoints[id];
+}
+
+const std::vector<cv::Point3f> &BoardModel::getPoints() const
+{
+    return mPoints;
+}
@@ -0,0 +1,23 @@
+#include "calibCommon.hpp"
+#include "display.hpp"
+
+#include <opencv2/cvconfig.h>
+#include <iostream>
+
+bool calib::showOverlayMessage(const std::string& message)
+{
+#ifdef HAVE_QT
+    Display::instance().showOverlay(mainWindowName, message, OVERLAY_DELAY);
+    return true;
+#else
+    std::cout << message << std::endl;
+    return false;
+#endif
+}
+
+cv::Size calib::getPreviewSize(cv::Size imageSize, int previewWidth)
+{
+    if(previewWidth <= 0 || previewWidth >= imageSize.width)
+        return imageSize;
+    return cv::Size(previewWidth, cvRound((double)imageSize.height * previewWidth / imageSize.width));
+}
@@ -1,4 +1,5 @@
 #include "calibController.hpp"
+#include "profiler.hpp"
 
 #include <algorithm>
 #include <cmath>
@@ -6,39 +7,11 @@
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
 
-double calib::calibController::estimateCoverageQuality()
-{
-    int gridSize = 10;
-    int xGridStep = mCalibData->imageSize.width / gridSize;
-    int yGridStep = mCalibData->imageSize.height / gridSize;
-    std::vector<int> pointsInCell(gridSize*gridSize);
-
-    std::fill(pointsInCell.begin(), pointsInCell.end(), 0);
-
-    for(auto it = mCalibData->imagePoints.begin(); it != mCalibData->imagePoints.cend(); ++it)
-        for(auto pointIt = (*it).begin(); pointIt != (*it).end(); ++pointIt) {
-            int i = (int)((*pointIt).x / xGridStep);
-            int j = (int)((*pointIt).y / yGridStep);
-            pointsInCell[i*gridSize + j]++;
-        }
-
-    for(auto it = mCalibData->allCharucoCorners.begin(); it != mCalibData->allCharucoCorners.cend(); ++it)
-        for(int l = 0; l < (*it).size[0]; l++) {
-            int i = (int)((*it).at<float>(l, 0) / xGridStep);
-            int j = (int)((*it).at<float>(l, 1) / yGridStep);
-            pointsInCell[i*gridSize + j]++;
-        }
-
-    cv::Mat mean, stdDev;
-    cv::meanStdDev(pointsInCell, mean, stdDev);
-
-    return mean.at<double>(0) / (stdDev.at<double>(0) + 1e-7);
-}
-
 calib::calibController::calibController() :
     mCalibData(nullptr)
 {
     mCalibFlags = 0;
+    mParallelTuning = false;
 }
 
 calib::calibController::calibController(Sptr<calib::calibrationData> data, int initialFlags, bool autoTuning, int minFramesNum) :
@@ -46,6 +19,7 @@ calib::calibController::calibController(Sptr<calib::calibrationData> data, int i
 {
     mCalibFlags = initialFlags;
     mNeedTuning = autoTuning;
+    mParallelTuning = false;
     mMinFramesNum = minFramesNum;
     mConfIntervalsState = false;
     mCoverageQualityState = false;
@@ -53,78 +27,69 @@ calib::calibController::calibController(Sptr<calib::calibrationData> data, int i
 
 void calib::calibController::updateState()
 {
-    if(mCalibData->cameraMatrix.total()) {
-        const double relErrEps = 0.05;
-        bool fConfState = false, cConfState = false, dConfState = true;
-        if(sigmaMult*mCalibData->stdDeviations.at<double>(0) / mCalibData->cameraMatrix.at<double>(0,0) < relErrEps &&
-                sigmaMult*mCalibData->stdDeviations.at<double>(1) / mCalibData->cameraMatrix.at<double>(1,1) < relErrEps)
-            fConfState = true;
-        if(sigmaMult*mCalibData->stdDeviations.at<double>(2) / mCalibData->cameraMatrix.at<double>(0,2) < relErrEps &&
-                sigmaMult*mCalibData->stdDeviations.at<double>(3) / mCalibData->cameraMatrix.at<double>(1,2) < relErrEps)
-            cConfState = true;
-
-        for(int i = 0; i < 5; i++)
-            if(mCalibData->stdDeviations.at<double>(4+i) / fabs(mCalibData->distCoeffs.at<double>(i)) > 1)
-                dConfState = false;
-
-        mConfIntervalsState = fConfState && cConfState && dConfState;
-    }
+    if(mCalibData->cameraMatrix.total())
+        mConfIntervalsState = checkConfidenceIntervals(mCalibData->cameraMatrix, mCalibData->distCoeffs,
+                                                       mCalibData->stdDeviations);
 
     if(getFramesNumberState())
-        mCoverageQualityState = estimateCoverageQuality() > 1.8 ? true : false;
-
-    if (getFramesNumberState() && mNeedTuning) {
-        if( !(mCalibFlags & cv::CALIB_FIX_ASPECT_RATIO) &&
-            mCalibData->cameraMatrix.total()) {
-            double fDiff = fabs(mCalibData->cameraMatrix.at<double>(0,0) -
-                                mCalibData->cameraMatrix.at<double>(1,1));
-
-            if (fDiff < 3*mCalibData->stdDeviations.at<double>(0) &&
-                    fDiff < 3*mCalibData->stdDeviations.at<double>(1)) {
-                mCalibFlags |= cv::CALIB_FIX_ASPECT_RATIO;
-                mCalibData->cameraMatrix.at<double>(0,0) =
-                        mCalibData->cameraMatrix.at<double>(1,1);
-            }
-        }
-
-        if(!(mCalibFlags & cv::CALIB_ZERO_TANGENT_DIST)) {
-            const double eps = 0.005;
-            if(fabs(mCalibData->distCoeffs.at<double>(2)) < eps &&
-                    fabs(mCalibData->distCoeffs.at<double>(3)) < eps)
-                mCalibFlags |= cv::CALIB_ZERO_TANGENT_DIST;
-        }
+        mCoverageQualityState = mCalibData->coverage.getQuality() > 1.8 ? true : false;
 
-        if(!(mCalibFlags & cv::CALIB_FIX_K1)) {
-            const double eps = 0.005;
-            if(fabs(mCalibData->distCoeffs.at<double>(0)) < eps)
-                mCalibFlags |= cv::CALIB_FIX_K1;
-        }
+    if (getFramesNumberState() && mNeedTuning && !mParallelTuning) {
+        int fixableFlags = getFixableFlags();
+        if(fixableFlags & cv::CALIB_FIX_ASPECT_RATIO)
+            mCalibData->cameraMatrix.at<double>(0,0) = mCalibData->cameraMatrix.at<double>(1,1);
+        mCalibFlags |= fixableFlags;
+    }
+}
 
-        if(!(mCalibFlags & cv::CALIB_FIX_K2)) {
-            const double eps = 0.005;
-            if(fabs(mCalibData->distCoeffs.at<double>(1)) < eps)
-                mCalibFlags |= cv::CALIB_FIX_K2;
-        }
+int calib::calibController::getFixableFlags() const
+{
+    int flags = 0;
+    if(!mCalibData->cameraMatrix.total())
+        return flags;
 
-        if(!(mCalibFlags & cv::CALIB_FIX_K3)) {
-            const double eps = 0.005;
-            if(fabs(mCalibData->distCoeffs.at<double>(4)) < eps)
-                mCalibFlags |= cv::CALIB_FIX_K3;
-        }
+    if(!(mCalibFlags & cv::CALIB_FIX_ASPECT_RATIO)) {
+        double fDiff = fabs(mCalibData->cameraMatrix.at<double>(0,0) -
+                            mCalibData->cameraMatrix.at<double>(1,1));
 
+        if (fDiff < 3*mCalibData->stdDeviations.at<double>(0) &&
+                fDiff < 3*mCalibData->stdDeviations.at<double>(1))
+            flags |= cv::CALIB_FIX_ASPECT_RATIO;
     }
+
+    const double eps = 0.005;
+    if(!(mCalibFlags & cv::CALIB_ZERO_TANGENT_DIST) &&
+            fabs(mCalibData->distCoeffs.at<double>(2)) < eps &&
+            fabs(mCalibData->distCoeffs.at<double>(3)) < eps)
+        flags |= cv::CALIB_ZERO_TANGENT_DIST;
+
+    if(!(mCalibFlags & cv::CALIB_FIX_K1) && fabs(mCalibData->distCoeffs.at<double>(0)) < eps)
+        flags |= cv::CALIB_FIX_K1;
+
+    if(!(mCalibFlags & cv::CALIB_FIX_K2) && fabs(mCalibData->distCoeffs.at<double>(1)) < eps)
+        flags |= cv::CALIB_FIX_K2;
+
+    if(!(mCalibFlags & cv::CALIB_FIX_K3) && fabs(mCalibData->distCoeffs.at<double>(4)) < eps)
+        flags |= cv::CALIB_FIX_K3;
+
+    return flags;
 }
 
 bool calib::calibController::getCommonCalibrationState() const
+{
+    return getUnmetCriteriaNumber() == 0;
+}
+
+int calib::calibController::getUnmetCriteriaNumber() const
 {
     int rating = (int)getFramesNumberState() + (int)getConfidenceIntrervalsState() +
-            (int)getRMSState() + (int)mCoverageQualityState;
-    return rating == 4;
+            (int)getRMSState() + (int)getPointsCoverageState();
+    return 4 - rating;
 }
 
 bool calib::calibController::getFramesNumberState() const
 {
-    return std::max(mCalibData->imagePoints.size(), mCalibData->allCharucoCorners.size()) > mMinFramesNum;
+    return mCalibData->points.getViewsNumber() > mMinFramesNum;
 }
 
 bool calib::calibController::getConfidenceIntrervalsState() const
@@ -137,45 +102,79 @@ bool calib::calibController::getRMSState() const
     return mCalibData->totalAvgErr < 0.5;
 }
 
+bool calib::calibController::getPointsCoverageState() const
+{
+    return mCoverageQualityState;
+}
+
 int calib::calibController::getNewFlags() const
 {
     return mCalibFlags;
 }
 
+void calib::calibController::setParallelTuning(bool isEnabled)
+{
+    mParallelTuning = isEnabled;
+}
+
+std::vector<int> calib::calibController::getCandidateFlags() const
+{
+    std::vector<int> candidates;
+    if(!mNeedTuning || !mParallelTuning || !getFramesNumberState() || !mCalibData->cameraMatrix.total())
+        return candidates;
+
+    // only the parameters the greedy tuning would fix are proposed: a fixed parameter has no
+    // deviation and hardly changes the error, so it would win the comparison anyway
+    const int tunedFlags[] = { cv::CALIB_FIX_ASPECT_RATIO, cv::CALIB_ZERO_TANGENT_DIST,
+                               cv::CALIB_FIX_K3, cv::CALIB_FIX_K2, cv::CALIB_FIX_K1 };
+    int freeFlags = getFixableFlags();
+    if(!freeFlags)
+        return candidates;
+    candidates.push_back(mCalibFlags);
+    for(int flag : tunedFlags)
+        if(freeFlags & flag)
+            candidates.push_back(mCalibFlags | flag);
+
+    // the usual outcome of several greedy steps: no tangential and no high order radial distortion
+    int simpleModel = mCalibFlags | (freeFlags & (cv::CALIB_ZERO_TANGENT_DIST | cv::CALIB_FIX_K3));
+    int fixedModel = mCalibFlags | freeFlags;
+    for(int flags : { simpleModel, simpleModel | (freeFlags & cv::CALIB_FIX_ASPECT_RATIO), fixedModel })
+        if(std::find(candidates.begin(), candidates.end(), flags) == candidates.end())
+            candidates.push_back(flags);
+    return candidates;
+}
+
+void calib::calibController::setTunedFlags(int flags)
+{
+    mCalibFlags = flags;
+}
+
+bool calib::calibController::checkConfidenceIntervals(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+                                                      const cv::Mat &stdDeviations)
+{
+    const double relErrEps = 0.05;
+    bool fConfState = false, cConfState = false, dConfState = true;
+    if(sigmaMult*stdDeviations.at<double>(0) / cameraMatrix.at<double>(0,0) < relErrEps &&
+            sigmaMult*stdDeviations.at<double>(1) / cameraMatrix.at<double>(1,1) < relErrEps)
+        fConfState = true;
+    if(sigmaMult*stdDeviations.at<double>(2) / cameraMatrix.at<double>(0,2) < relErrEps &&
+            sigmaMult*stdDeviations.at<double>(3) / cameraMatrix.at<double>(1,2) < relErrEps)
+        cConfState = true;
+
+    for(int i = 0; i < 5; i++)
+        if(stdDeviations.at<double>(4+i) / fabs(distCoeffs.at<double>(i)) > 1)
+            dConfState = false;
+
+    return fConfState && cConfState && dConfState;
+}
+
 
 //////////////////// calibDataController
 
-double calib::calibDataController::estimateGridSubsetQuality(size_t excludedIndex)
+void calib::calibDataController::updateCoverageIndex()
 {
-    {
-        int gridSize = 10;
-        int xGridStep = mCalibData->imageSize.width / gridSize;
-        int yGridStep = mCalibData->imageSize.height / gridSize;
-        std::vector<int> pointsInCell(gridSize*gridSize);
-
-        std::fill(pointsInCell.begin(), pointsInCell.end(), 0);
-
-        for(size_t k = 0; k < mCalibData->imagePoints.size(); k++)
-            if(k != excludedIndex)
-                for(auto pointIt = mCalibData->imagePoints[k].begin(); pointIt != mCalibData->imagePoints[k].cend(); ++pointIt) {
-                    int i = (int)((*pointIt).x / xGridStep);
-                    int j = (int)((*pointIt).y / yGridStep);
-                    pointsInCell[i*gridSize + j]++;
-                }
-
-        for(size_t k = 0; k < mCalibData->allCharucoCorners.size(); k++)
-            if(k != excludedIndex)
-                for(int l = 0; l <  mCalibData->allCharucoCorners[k].size[0]; l++) {
-                    int i = (int)(mCalibData->allCharucoCorners[k].at<float>(l, 0) / xGridStep);
-                    int j = (int)(mCalibData->allCharucoCorners[k].at<float>(l, 1) / yGridStep);
-                    pointsInCell[i*gridSize + j]++;
-                }
-
-        cv::Mat mean, stdDev;
-        cv::meanStdDev(pointsInCell, mean, stdDev);
-
-        return mean.at<double>(0) / (stdDev.at<double>(0) + 1e-7);
-    }
+    if(mCalibData->coverage.getViewsNumber() != mCalibData->points.getViewsNumber())
+        mCalibData->coverage.rebuild(mCalibData->coverage.getImageSize(), mCalibData->points);
 }
 
 calib::calibDataController::calibDataController(Sptr<calib::calibrationData> data, int maxFrames, double convParameter) :
@@ -183,23 +182,26 @@ calib::calibDataController::calibDataController(Sptr<calib::calibrationData> dat
 {
     mMaxFramesNum = maxFrames;
     mAlpha = convParameter;
+    mPreviewWidth = 0;
 }
 
 calib::calibDataController::calibDataController()
 {
-
+    mPreviewWidth = 0;
 }
 
 void calib::calibDataController::filterFrames()
 {
-    size_t numberOfFrames = std::max(mCalibData->allCharucoIds.size(), mCalibData->imagePoints.size());
+    ScopedTimer timer(ProfileStage::FilterFrames);
+    size_t numberOfFrames = mCalibData->points.getViewsNumber();
     CV_Assert(numberOfFrames == mCalibData->perViewErrors.total());
     if(numberOfFrames >= mMaxFramesNum) {
+        updateCoverageIndex();
 
-        double worstValue = -HUGE_VAL, maxQuality = estimateGridSubsetQuality(numberOfFrames);
+        double worstValue = -HUGE_VAL, maxQuality = mCalibData->coverage.getQuality();
         size_t worstElemIndex = 0;
         for(size_t i = 0; i < numberOfFrames; i++) {
-            double gridQDelta = estimateGridSubsetQuality(i) - maxQuality;
+            double gridQDelta = mCalibData->coverage.getQualityWithout(i) - maxQuality;
             double currentValue = mCalibData->perViewErrors.at<double>(i)*mAlpha + gridQDelta*(1. - mAlpha);
             if(currentValue > worstValue) {
                 worstValue = currentValue;
@@ -208,14 +210,15 @@ void calib::calibDataController::filterFrames()
         }
         showOverlayMessage(cv::format("Frame %d is worst", worstElemIndex + 1));
 
-        if(mCalibData->imagePoints.size()) {
-            mCalibData->imagePoints.erase(mCalibData->imagePoints.begin() + worstElemIndex);
-            mCalibData->objectPoints.erase(mCalibData->objectPoints.begin() + worstElemIndex);
-        }
-        else {
-            mCalibData->allCharucoCorners.erase(mCalibData->allCharucoCorners.begin() + worstElemIndex);
-            mCalibData->allCharucoIds.erase(mCalibData->allCharucoIds.begin() + worstElemIndex);
+        mCalibData->points.removeView(worstElemIndex);
+        if(mCalibData->journal)
+            mCalibData->journal->removeView(worstElemIndex);
+        mCalibData->coverage.removeView(worstElemIndex);
+        if(worstElemIndex < mCalibData->rvecs.size() && worstElemIndex < mCalibData->tvecs.size()) {
+            mCalibData->rvecs.erase(mCalibData->rvecs.begin() + worstElemIndex);
+            mCalibData->tvecs.erase(mCalibData->tvecs.begin() + worstElemIndex);
         }
+        mCalibData->removalsCount++;
 
         cv::Mat newErrorsVec = cv::Mat(numberOfFrames - 1, 1, CV_64F);
         //std::copy_n(mCalibData->perViewErrors.ptr<double>(0), worstElemIndex, newErrorsVec.ptr<double>(0));
@@ -233,16 +236,24 @@ void calib::calibDataController::setParametersFileName(const std::string &name)
     mParamsFileName = name;
 }
 
-void calib::calibDataController::deleteLastFrame()
+void calib::calibDataController::setPreviewWidth(int width)
 {
-    if( !mCalibData->imagePoints.empty()) {
-        mCalibData->imagePoints.pop_back();
-        mCalibData->objectPoints.pop_back();
-    }
+    mPreviewWidth = width;
+}
 
-    if (!mCalibData->allCharucoCorners.empty()) {
-        mCalibData->allCharucoCorners.pop_back();
-        mCalibData->allCharucoIds.pop_back();
+void calib::calibDataController::deleteLastFrame()
+{
+    mCalibData->removalsCount++;
+    if(mCalibData->journal && !mCalibData->points.empty())
+        mCalibData->journal->removeView(mCalibData->points.getViewsNumber() - 1);
+    mCalibData->points.removeLastView();
+
+    size_t framesNum = mCalibData->points.getViewsNumber();
+    if(mCalibData->coverage.getViewsNumber() > framesNum)
+        mCalibData->coverage.removeLastView();
+    if(mCalibData->rvecs.size() > framesNum) {
+        mCalibData->rvecs.resize(framesNum);
+        mCalibData->tvecs.resize(framesNum);
     }
 
     if(!mParamsStack.empty()) {
@@ -265,10 +276,13 @@ void calib::calibDataController::rememberCurrentParameters()
 
 void calib::calibDataController::deleteAllData()
 {
-    mCalibData->imagePoints.clear();
-    mCalibData->objectPoints.clear();
-    mCalibData->allCharucoCorners.clear();
-    mCalibData->allCharucoIds.clear();
+    mCalibData->points.clear();
+    if(mCalibData->journal)
+        mCalibData->journal->clear();
+    mCalibData->rvecs.clear();
+    mCalibData->tvecs.clear();
+    mCalibData->coverage.clear();
+    mCalibData->removalsCount++;
     mCalibData->cameraMatrix = mCalibData->distCoeffs = cv::Mat();
     mParamsStack = std::stack<cameraParameters>();
     rememberCurrentParameters();
@@ -286,7 +300,7 @@ bool calib::calibDataController::saveCurrentCameraParameters() const
                 strftime(buf, sizeof(buf)-1, "%c", localtime(&rawtime));
 
                 parametersWriter << "calibrationDate" << buf;
-                parametersWriter << "framesCount" << std::max((int)mCalibData->objectPoints.size(), (int)mCalibData->allCharucoCorners.size());
+                parametersWriter << "framesCount" << (int)mCalibData->points.getViewsNumber();
                 parametersWriter << "cameraResolution" << mCalibData->imageSize;
                 parametersWriter << "cameraMatrix" << mCalibData->cameraMatrix;
                 parametersWriter << "cameraMatrix_std_dev" << mCalibData->stdDeviations.rowRange(cv::Range(0, 4));
@@ -305,7 +319,7 @@ void calib::calibDataController::printParametersToConsole(std::ostream &output)
 {
     const char* border = "---------------------------------------------------";
     output << border << std::endl;
-    output << "Frames used for calibration: " << std::max(mCalibData->objectPoints.size(), mCalibData->allCharucoCorners.size())
+    output << "Frames used for calibration: " << mCalibData->points.getViewsNumber()
            << " \t RMS = " << mCalibData->totalAvgErr << std::endl;
     if(mCalibData->cameraMatrix.at<double>(0,0) == mCalibData->cameraMatrix.at<double>(1,1))
         output << "F = " << mCalibData->cameraMatrix.at<double>(1,1) << " +- " << sigmaMult*mCalibData->stdDeviations.at<double>(1) << std::endl;
@@ -323,8 +337,8 @@ void calib::calibDataController::printParametersToConsole(std::ostream &output)
 
 void calib::calibDataController::updateUndistortMap()
 {
-    cv::initUndistortRectifyMap(mCalibData->cameraMatrix, mCalibData->distCoeffs, cv::noArray(),
-                                cv::getOptimalNewCameraMatrix(mCalibData->cameraMatrix, mCalibData->distCoeffs, mCalibData->imageSize, 0.0, mCalibData->imageSize),
-                                mCalibData->imageSize, CV_16SC2, mCalibData->undistMap1, mCalibData->undistMap2);
+    // the maps are built for the preview, which is undistorted after downscaling
+    mCalibData->undistortMap.update(mCalibData->cameraMatrix, mCalibData->distCoeffs, mCalibData->imageSize,
+                                    getPreviewSize(mCalibData->imageSize, mPreviewWidth));
 
 }
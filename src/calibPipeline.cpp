@@ -1,91 +1,221 @@
 #include "calibPipeline.hpp"
+#include "display.hpp"
+#include "pipelineExecutor.hpp"
+#include "framePool.hpp"
+#include "profiler.hpp"
 #include <opencv2/highgui.hpp>
 #include <exception>
 
 using namespace calib;
 
-#define CAP_DELAY 10
+#define FRAMES_RING_SIZE 3
 
-cv::Size CalibPipeline::getCameraResolution()
+static cv::Size getCameraResolution(cv::VideoCapture& capture)
 {
-    mCapture.set(cv::CAP_PROP_FRAME_WIDTH, 10000);
-    mCapture.set(cv::CAP_PROP_FRAME_HEIGHT, 10000);
-    int w = (int)mCapture.get(cv::CAP_PROP_FRAME_WIDTH);
-    int h = (int)mCapture.get(cv::CAP_PROP_FRAME_HEIGHT);
+    capture.set(cv::CAP_PROP_FRAME_WIDTH, 10000);
+    capture.set(cv::CAP_PROP_FRAME_HEIGHT, 10000);
+    int w = (int)capture.get(cv::CAP_PROP_FRAME_WIDTH);
+    int h = (int)capture.get(cv::CAP_PROP_FRAME_HEIGHT);
     return cv::Size(w,h);
 }
 
 CalibPipeline::CalibPipeline(captureParameters params) :
-    mCaptureParams(params)
+    mCaptureParams(params),
+    mFrames(FRAMES_RING_SIZE, params.source == InputVideoSource::Camera ?
+                FrameDropPolicy::DropOldest : FrameDropPolicy::Block)
 {
+    mStopCapture = false;
+    mProcessedFrames = 0;
+}
 
+CalibPipeline::~CalibPipeline()
+{
+    mStopCapture = true;
+    mFrames.close();
+    if(mCaptureThread.joinable())
+        mCaptureThread.join();
 }
 
-PipelineExitStatus CalibPipeline::start(std::vector<Sptr<FrameProcessor>> processors)
+void CalibPipeline::openVideoCapture(cv::VideoCapture &capture, captureParameters &params)
 {
-    if(mCaptureParams.source == InputVideoSource::Camera && !mCapture.isOpened())
+    if(params.source == InputVideoSource::Camera)
     {
-        mCapture.open(mCaptureParams.camID);
-        cv::Size maxRes = getCameraResolution();
-        cv::Size neededRes = mCaptureParams.cameraResolution;
+        capture.open(params.camID);
+        cv::Size maxRes = getCameraResolution(capture);
+        cv::Size neededRes = params.cameraResolution;
 
         if(maxRes.width < neededRes.width) {
             double aR = (double)maxRes.width / maxRes.height;
-            mCapture.set(cv::CAP_PROP_FRAME_WIDTH, neededRes.width);
-            mCapture.set(cv::CAP_PROP_FRAME_HEIGHT, neededRes.width/aR);
+            capture.set(cv::CAP_PROP_FRAME_WIDTH, neededRes.width);
+            capture.set(cv::CAP_PROP_FRAME_HEIGHT, neededRes.width/aR);
         }
         else if(maxRes.height < neededRes.height) {
             double aR = (double)maxRes.width / maxRes.height;
-            mCapture.set(cv::CAP_PROP_FRAME_HEIGHT, neededRes.height);
-            mCapture.set(cv::CAP_PROP_FRAME_WIDTH, neededRes.height*aR);
+            capture.set(cv::CAP_PROP_FRAME_HEIGHT, neededRes.height);
+            capture.set(cv::CAP_PROP_FRAME_WIDTH, neededRes.height*aR);
         }
         else {
-            mCapture.set(cv::CAP_PROP_FRAME_HEIGHT, neededRes.height);
-            mCapture.set(cv::CAP_PROP_FRAME_WIDTH, neededRes.width);
+            capture.set(cv::CAP_PROP_FRAME_HEIGHT, neededRes.height);
+            capture.set(cv::CAP_PROP_FRAME_WIDTH, neededRes.width);
         }
-        mCapture.set(cv::CAP_PROP_AUTOFOCUS, 0);
-        mCaptureParams.fps = (int)mCapture.get(cv::CAP_PROP_FPS);
+        capture.set(cv::CAP_PROP_AUTOFOCUS, 0);
+        params.fps = (int)capture.get(cv::CAP_PROP_FPS);
     }
-    else if (mCaptureParams.source == InputVideoSource::File && !mCapture.isOpened())
-        mCapture.open(mCaptureParams.videoFileName);
+    else if (params.source == InputVideoSource::File)
+        capture.open(params.videoFileName);
+
+    if(!capture.isOpened())
+        throw std::runtime_error("Unable to open video source");
+}
+
+void CalibPipeline::openCapture()
+{
+    openVideoCapture(mCapture, mCaptureParams);
     mImageSize = cv::Size((int)mCapture.get(cv::CAP_PROP_FRAME_WIDTH), (int)mCapture.get(cv::CAP_PROP_FRAME_HEIGHT));
+}
 
+void CalibPipeline::open()
+{
     if(!mCapture.isOpened())
-        throw std::runtime_error("Unable to open video source");
+        openCapture();
+}
 
-    cv::Mat frame, processedFrame;
-    while(mCapture.grab()) {
-        mCapture.retrieve(frame);
-        if(mCaptureParams.flipVertical)
+void CalibPipeline::captureFrames()
+{
+    cv::Mat frame;
+    long long grabbedFrames = 0;
+    while(!mStopCapture) {
+        Profiler::setCurrentFrame(grabbedFrames++);
+        {
+            ScopedTimer timer(ProfileStage::Capture);
+            if(!mCapture.grab())
+                break;
+            // frames are processed in place, a buffer still used downstream is not refilled
+            if(FramePool::isShared(frame))
+                frame.release();
+            mCapture.retrieve(frame);
+        }
+        Profiler::instance().addCount(ProfileCounter::GrabbedFrames);
+        if(mCaptureParams.flipVertical) {
+            ScopedTimer timer(ProfileStage::Flip);
             cv::flip(frame, frame, -1);
+        }
+        if(!mFrames.push(frame))
+            break;
+    }
+    mFrames.close();
+}
 
-        frame.copyTo(processedFrame);
+PipelineExitStatus CalibPipeline::getKeyStatus(int key)
+{
+    if(key == 27) // esc
+        return PipelineExitStatus::Finished;
+    else if (key == 114) // r
+        return PipelineExitStatus::DeleteLastFrame;
+    else if (key == 100) // d
+        return PipelineExitStatus::DeleteAllFrames;
+    else if (key == 115) // s
+        return PipelineExitStatus::SaveCurrentData;
+    else if (key == 117) // u
+        return PipelineExitStatus::SwitchUndistort;
+    else if (key == (117 | BUTTON_CHECKED_KEY)) // "Undistort" checkbox
+        return PipelineExitStatus::EnableUndistort;
+    else if (key == (117 | BUTTON_UNCHECKED_KEY))
+        return PipelineExitStatus::DisableUndistort;
+    else if (key == 118) // v
+        return PipelineExitStatus::SwitchVisualisation;
+    return PipelineExitStatus::Continue;
+}
+
+PipelineExitStatus CalibPipeline::processSequentially(std::vector<Sptr<FrameProcessor>>& processors)
+{
+    cv::Mat frame, processedFrame;
+    while(mFrames.pop(frame)) {
+        Profiler::setCurrentFrame((long long)mProcessedFrames++);
+        Profiler::instance().addCount(ProfileCounter::ProcessedFrames);
+        processedFrame = frame;
         for (auto it = processors.begin(); it != processors.end(); ++it)
             processedFrame = (*it)->processFrame(processedFrame);
-        cv::imshow(mainWindowName, processedFrame);
-        int key = cv::waitKey(CAP_DELAY);
-
-        if(key == 27) // esc
-            return PipelineExitStatus::Finished;
-        else if (key == 114) // r
-            return PipelineExitStatus::DeleteLastFrame;
-        else if (key == 100) // d
-            return PipelineExitStatus::DeleteAllFrames;
-        else if (key == 115) // s
-            return PipelineExitStatus::SaveCurrentData;
-        else if (key == 117) // u
-            return PipelineExitStatus::SwitchUndistort;
-        else if (key == 118) // v
-            return PipelineExitStatus::SwitchVisualisation;
+        Display::instance().show(mainWindowName, processedFrame);
+        processedFrame.release();
+
+        PipelineExitStatus status = getKeyStatus(Display::instance().pollKey());
+        if(status != PipelineExitStatus::Continue)
+            return status;
 
         for (auto it = processors.begin(); it != processors.end(); ++it)
             if((*it)->isProcessed())
                 return PipelineExitStatus::Calibrate;
+
+        if(mCalibWorker && mCalibWorker->isResultReady())
+            return PipelineExitStatus::CalibrationReady;
     }
 
     return PipelineExitStatus::Finished;
 }
 
+PipelineExitStatus CalibPipeline::processPipelined(std::vector<Sptr<FrameProcessor>>& processors)
+{
+    PipelineExecutor executor(processors, (unsigned)mCaptureParams.processingThreads,
+                              processors.size() + mCaptureParams.processingThreads, mProcessedFrames);
+    PipelineExitStatus status = PipelineExitStatus::Finished;
+    // a camera keeps only its newest frames, like the ring buffer does, so a frame finding the
+    // pipeline full is dropped; the frames of a file wait for a result to free a place
+    bool dropFrames = mCaptureParams.source == InputVideoSource::Camera;
+    cv::Mat frame, processedFrame, lastFrame;
+
+    while(mFrames.pop(frame)) {
+        while(!executor.trySubmit(frame) && !dropFrames)
+            if(executor.getResult(processedFrame, true))
+                lastFrame = processedFrame;
+        frame.release();
+        while(executor.getResult(processedFrame, false))
+            lastFrame = processedFrame;
+        processedFrame.release();
+        if(!lastFrame.empty()) {
+            Display::instance().show(mainWindowName, lastFrame);
+            lastFrame.release();
+        }
+
+        status = getKeyStatus(Display::instance().pollKey());
+        if(status != PipelineExitStatus::Continue)
+            break;
+
+        for (auto it = processors.begin(); it != processors.end(); ++it)
+            if((*it)->isProcessed())
+                status = PipelineExitStatus::Calibrate;
+        if(status == PipelineExitStatus::Continue && mCalibWorker && mCalibWorker->isResultReady())
+            status = PipelineExitStatus::CalibrationReady;
+        if(status != PipelineExitStatus::Continue)
+            break;
+    }
+    if(status == PipelineExitStatus::Continue)
+        status = PipelineExitStatus::Finished;
+
+    // processors must be idle before the caller touches the calibration data
+    executor.drain();
+    mProcessedFrames += executor.getSubmittedFramesNum();
+    return status;
+}
+
+PipelineExitStatus CalibPipeline::start(std::vector<Sptr<FrameProcessor>> processors)
+{
+    // from here on the capture thread is the only user of mCapture
+    if(!mCaptureThread.joinable()) {
+        open();
+        mCaptureThread = std::thread(&CalibPipeline::captureFrames, this);
+    }
+
+    if(mCaptureParams.processingThreads > 0)
+        return processPipelined(processors);
+    return processSequentially(processors);
+}
+
+void CalibPipeline::setCalibWorker(Sptr<CalibWorker> worker)
+{
+    mCalibWorker = worker;
+}
+
 cv::Size CalibPipeline::getImageSize() const
 {
     return mImageSize;
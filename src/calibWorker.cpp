@@ -0,0 +1,234 @@
+#include "calibWorker.hpp"
+#include "calibController.hpp"
+#include "cvCalibrationFork.hpp"
+#include "profiler.hpp"
+
+#include <opencv2/calib3d.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+
+using namespace calib;
+
+// a candidate with more fixed parameters may have a slightly larger error than the current flags
+#define TUNING_RMS_TOLERANCE 0.02
+
+namespace {
+
+int countBits(int value)
+{
+    int count = 0;
+    for(; value; value &= value - 1)
+        count++;
+    return count;
+}
+
+}
+
+CalibWorker::CalibWorker(cv::TermCriteria termCrit, double lossScale) :
+    mTermCrit(termCrit)
+{
+    mLossScale = lossScale;
+    mFlags = 0;
+    mRemovalsCount = 0;
+    mHasTask = mIsBusy = mHasResult = mStop = false;
+    mGeneration = 0;
+    mThread = std::thread(&CalibWorker::run, this);
+}
+
+CalibWorker::~CalibWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    if(mThread.joinable())
+        mThread.join();
+}
+
+bool CalibWorker::requestCalibration(const calibrationData &data, int flags, const std::vector<int> &candidateFlags)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mHasTask || mIsBusy)
+        return false;
+
+    mPoints = data.points;
+    mImageSize = data.imageSize;
+    mCameraMatrix = data.cameraMatrix.clone();
+    mDistCoeffs = data.distCoeffs.clone();
+    mRvecs.clear();
+    mTvecs.clear();
+    for(const cv::Mat& rvec : data.rvecs)
+        mRvecs.push_back(rvec.clone());
+    for(const cv::Mat& tvec : data.tvecs)
+        mTvecs.push_back(tvec.clone());
+    mFlags = flags;
+    mCandidateFlags = candidateFlags;
+    mRemovalsCount = data.removalsCount;
+
+    mHasTask = true;
+    mHasResult = false;
+    mCondition.notify_all();
+    return true;
+}
+
+bool CalibWorker::isBusy() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHasTask || mIsBusy;
+}
+
+bool CalibWorker::isResultReady() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHasResult;
+}
+
+bool CalibWorker::fetchResult(calibrationResult &result)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(!mHasResult)
+        return false;
+    result = mResult;
+    mResult = calibrationResult();
+    mHasResult = false;
+    return true;
+}
+
+void CalibWorker::cancel()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mGeneration++;
+    mHasTask = false;
+    mHasResult = false;
+}
+
+void CalibWorker::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true) {
+        mCondition.wait(lock, [this] { return mStop || mHasTask; });
+        if(mStop)
+            break;
+
+        mHasTask = false;
+        mIsBusy = true;
+        unsigned generation = mGeneration;
+        lock.unlock();
+
+        // PointStore::getPacked rewrites the store, so it is packed once before the solves start
+        cv::Mat objectPoints, imagePoints, npoints;
+        mPoints.getPacked(objectPoints, imagePoints, npoints);
+        calibrationResult result = mCandidateFlags.empty() ? calibrate(mFlags, objectPoints, imagePoints, npoints) :
+                                                             tune(objectPoints, imagePoints, npoints);
+
+        lock.lock();
+        mIsBusy = false;
+        if(generation == mGeneration) {
+            mResult = result;
+            mHasResult = true;
+        }
+    }
+}
+
+calibrationResult CalibWorker::calibrate(int flags, const cv::Mat& objectPoints, const cv::Mat& imagePoints,
+                                         const cv::Mat& npoints)
+{
+    // candidates are solved concurrently, so every solve owns its initial values
+    calibrationResult result;
+    result.cameraMatrix = mCameraMatrix.clone();
+    result.distCoeffs = mDistCoeffs.clone();
+    for(const cv::Mat& rvec : mRvecs)
+        result.rvecs.push_back(rvec.clone());
+    for(const cv::Mat& tvec : mTvecs)
+        result.tvecs.push_back(tvec.clone());
+    result.framesNum = mPoints.getViewsNumber();
+    result.removalsCount = mRemovalsCount;
+    result.flags = flags;
+    if((flags & cv::CALIB_FIX_ASPECT_RATIO) && (flags & cv::CALIB_USE_INTRINSIC_GUESS) && result.cameraMatrix.total())
+        result.cameraMatrix.at<double>(0,0) = result.cameraMatrix.at<double>(1,1);
+    // with an intrinsic guess a fixed coefficient keeps its value, a candidate fixes it at zero
+    // like the greedy tuning does
+    int newFixedFlags = flags & ~mFlags;
+    if((flags & cv::CALIB_USE_INTRINSIC_GUESS) && result.distCoeffs.total() >= 5) {
+        const int coeffFlags[] = { cv::CALIB_FIX_K1, cv::CALIB_FIX_K2, cv::CALIB_FIX_K3 };
+        const int coeffIndices[] = { 0, 1, 4 };
+        for(int i = 0; i < 3; i++)
+            if(newFixedFlags & coeffFlags[i])
+                result.distCoeffs.at<double>(coeffIndices[i]) = 0.;
+    }
+
+    using namespace std::chrono;
+    auto startPoint = high_resolution_clock::now();
+    try {
+        ScopedTimer timer(ProfileStage::Calibration);
+        result.totalAvgErr =
+                cvfork::calibrateCameraPacked(objectPoints, imagePoints, npoints, mImageSize, result.cameraMatrix,
+                                              result.distCoeffs, result.rvecs, result.tvecs,
+                                              result.stdDeviations, result.perViewErrors, flags, mTermCrit, mLossScale);
+    }
+    catch(const cv::Exception& e) {
+        result.errorMessage = e.what();
+    }
+    auto endPoint = high_resolution_clock::now();
+    result.calibrationTime = duration_cast<duration<double>>(endPoint - startPoint).count();
+
+    return result;
+}
+
+calibrationResult CalibWorker::tune(const cv::Mat& objectPoints, const cv::Mat& imagePoints, const cv::Mat& npoints)
+{
+    using namespace std::chrono;
+    auto startPoint = high_resolution_clock::now();
+
+    std::vector<calibrationResult> results(mCandidateFlags.size());
+    std::atomic<size_t> nextCandidate(0);
+    auto tuningWorker = [&]() {
+        for(size_t i = nextCandidate++; i < results.size(); i = nextCandidate++)
+            results[i] = calibrate(mCandidateFlags[i] | cv::CALIB_USE_INTRINSIC_GUESS | CALIB_USE_INITIAL_EXTRINSICS,
+                                   objectPoints, imagePoints, npoints);
+    };
+    size_t threadsNum = std::min(results.size(), (size_t)std::max(std::thread::hardware_concurrency(), 1u));
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < threadsNum; i++)
+        threads.push_back(std::thread(tuningWorker));
+    tuningWorker();
+    for(auto& thread : threads)
+        thread.join();
+
+    // the first candidate keeps the current flags, the others are compared with it
+    size_t best = 0;
+    bool bestConfState = false;
+    int bestFixedNum = 0;
+    if(results[0].errorMessage.empty())
+        bestConfState = calibController::checkConfidenceIntervals(results[0].cameraMatrix, results[0].distCoeffs,
+                                                                  results[0].stdDeviations);
+    double maxRms = results[0].errorMessage.empty() ? results[0].totalAvgErr*(1. + TUNING_RMS_TOLERANCE) :
+                                                      DBL_MAX;
+    for(size_t i = 1; i < results.size(); i++) {
+        const calibrationResult& candidate = results[i];
+        if(!candidate.errorMessage.empty() || candidate.totalAvgErr > maxRms)
+            continue;
+        bool confState = calibController::checkConfidenceIntervals(candidate.cameraMatrix, candidate.distCoeffs,
+                                                                   candidate.stdDeviations);
+        int fixedNum = countBits(mCandidateFlags[i] & ~mCandidateFlags[0]);
+        bool isBetter = !results[best].errorMessage.empty() ||
+                (confState != bestConfState ? confState :
+                 fixedNum != bestFixedNum ? fixedNum > bestFixedNum :
+                 candidate.totalAvgErr < results[best].totalAvgErr);
+        if(isBetter) {
+            best = i;
+            bestConfState = confState;
+            bestFixedNum = fixedNum;
+        }
+    }
+
+    calibrationResult result = results[best];
+    result.flags = mCandidateFlags[best];
+    result.isTuned = result.errorMessage.empty();
+    auto endPoint = high_resolution_clock::now();
+    result.calibrationTime = duration_cast<duration<double>>(endPoint - startPoint).count();
+    return result;
+}
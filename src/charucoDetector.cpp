@@ -0,0 +1,42 @@
+#include "charucoDetector.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+using namespace calib;
+
+CharucoDetector::CharucoDetector(cv::Ptr<cv::aruco::CharucoBoard> board, cv::Ptr<cv::aruco::Dictionary> dictionary) :
+    mBoard(board), mDictionary(dictionary)
+{
+    mMarkersBoard = mBoard.staticCast<cv::aruco::Board>();
+    mDetectorParams = cv::aruco::DetectorParameters::create();
+}
+
+int CharucoDetector::detect(const cv::Mat &frame, cv::Mat &charucoCorners, cv::Mat &charucoIds)
+{
+    if(frame.channels() == 3)
+        cv::cvtColor(frame, mGray, cv::COLOR_BGR2GRAY);
+    else
+        mGray = frame;
+
+    mMarkerCorners.clear();
+    mMarkerIds.clear();
+    mRejectedCandidates.clear();
+    cv::aruco::detectMarkers(mGray, mDictionary, mMarkerCorners, mMarkerIds, mDetectorParams, mRejectedCandidates);
+    if(mMarkerIds.empty())
+        return 0;
+
+    // refinement can only recover markers of the board that were missed
+    if(mMarkerIds.size() < mMarkersBoard->ids.size())
+        cv::aruco::refineDetectedMarkers(mGray, mMarkersBoard, mMarkerCorners, mMarkerIds, mRejectedCandidates,
+                                         cv::noArray(), cv::noArray(), 10.f, 3.f, true, cv::noArray(),
+                                         mDetectorParams);
+
+    return cv::aruco::interpolateCornersCharuco(mMarkerCorners, mMarkerIds, mGray, mBoard,
+                                                charucoCorners, charucoIds);
+}
+
+void CharucoDetector::drawMarkers(const cv::Mat &frame) const
+{
+    if(!mMarkerIds.empty())
+        cv::aruco::drawDetectedMarkers(frame, mMarkerCorners);
+}
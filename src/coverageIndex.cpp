@@ -0,0 +1,148 @@
+#include "coverageIndex.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace calib;
+
+CoverageIndex::CoverageIndex(int gridSize)
+{
+    mGridSize = std::max(gridSize, 1);
+    reset(cv::Size());
+}
+
+int CoverageIndex::getCellIndex(float x, float y) const
+{
+    int xGridStep = std::max(mImageSize.width / mGridSize, 1);
+    int yGridStep = std::max(mImageSize.height / mGridSize, 1);
+    int i = std::min(std::max((int)(x / xGridStep), 0), mGridSize - 1);
+    int j = std::min(std::max((int)(y / yGridStep), 0), mGridSize - 1);
+    return i*mGridSize + j;
+}
+
+void CoverageIndex::addCells(std::vector<int> &cells)
+{
+    std::sort(cells.begin(), cells.end());
+    std::vector<std::pair<int, int>> viewCells;
+    for(size_t k = 0; k < cells.size(); k++)
+        if(viewCells.empty() || viewCells.back().first != cells[k])
+            viewCells.push_back(std::make_pair(cells[k], 1));
+        else
+            viewCells.back().second++;
+
+    for(auto& cell : viewCells) {
+        int& n = mPointsInCell[cell.first];
+        mCellsSqSum += (double)(n + cell.second)*(n + cell.second) - (double)n*n;
+        mCellsSum += cell.second;
+        n += cell.second;
+    }
+    mViewCells.push_back(viewCells);
+}
+
+void CoverageIndex::setGridSize(int gridSize)
+{
+    mGridSize = std::max(gridSize, 1);
+    reset(mImageSize);
+}
+
+void CoverageIndex::reset(cv::Size imageSize)
+{
+    mImageSize = imageSize;
+    clear();
+}
+
+void CoverageIndex::rebuild(cv::Size imageSize, const PointStore &points)
+{
+    reset(imageSize);
+    for(size_t i = 0; i < points.getViewsNumber(); i++)
+        addView(points.getImagePoints(i), points.getPointsNumber(i));
+}
+
+void CoverageIndex::addView(const cv::Point2f *points, int pointsNum)
+{
+    std::vector<int> cells(pointsNum);
+    for(int l = 0; l < pointsNum; l++)
+        cells[l] = getCellIndex(points[l].x, points[l].y);
+    addCells(cells);
+}
+
+void CoverageIndex::removeView(size_t index)
+{
+    CV_Assert(index < mViewCells.size());
+    for(auto& cell : mViewCells[index]) {
+        int& n = mPointsInCell[cell.first];
+        mCellsSqSum -= (double)n*n - (double)(n - cell.second)*(n - cell.second);
+        mCellsSum -= cell.second;
+        n -= cell.second;
+    }
+    mViewCells.erase(mViewCells.begin() + index);
+}
+
+void CoverageIndex::removeLastView()
+{
+    if(!mViewCells.empty())
+        removeView(mViewCells.size() - 1);
+}
+
+void CoverageIndex::clear()
+{
+    mPointsInCell.assign(mGridSize*mGridSize, 0);
+    mViewCells.clear();
+    mCellsSum = mCellsSqSum = 0;
+}
+
+size_t CoverageIndex::getViewsNumber() const
+{
+    return mViewCells.size();
+}
+
+int CoverageIndex::getGridSize() const
+{
+    return mGridSize;
+}
+
+cv::Size CoverageIndex::getImageSize() const
+{
+    return mImageSize;
+}
+
+int CoverageIndex::getCellCount(int x, int y) const
+{
+    return mPointsInCell[x*mGridSize + y];
+}
+
+int CoverageIndex::getMaxCellCount() const
+{
+    return *std::max_element(mPointsInCell.begin(), mPointsInCell.end());
+}
+
+cv::Rect CoverageIndex::getCellRect(int x, int y) const
+{
+    int xGridStep = std::max(mImageSize.width / mGridSize, 1);
+    int yGridStep = std::max(mImageSize.height / mGridSize, 1);
+    int width = x == mGridSize - 1 ? mImageSize.width - x*xGridStep : xGridStep;
+    int height = y == mGridSize - 1 ? mImageSize.height - y*yGridStep : yGridStep;
+    return cv::Rect(x*xGridStep, y*yGridStep, width, height);
+}
+
+double CoverageIndex::getQuality() const
+{
+    return getQualityWithout(mViewCells.size());
+}
+
+double CoverageIndex::getQualityWithout(size_t index) const
+{
+    double sum = mCellsSum, sqSum = mCellsSqSum;
+    if(index < mViewCells.size())
+        for(auto& cell : mViewCells[index]) {
+            int n = mPointsInCell[cell.first];
+            sqSum -= (double)n*n - (double)(n - cell.second)*(n - cell.second);
+            sum -= cell.second;
+        }
+
+    double cellsNum = (double)mPointsInCell.size();
+    double mean = sum / cellsNum;
+    double stdDev = std::sqrt(std::max(sqSum / cellsNum - mean*mean, 0.));
+
+    return mean / (stdDev + 1e-7);
+}
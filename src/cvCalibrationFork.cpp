@@ -1,17 +1,501 @@
 #include <opencv2/calib3d.hpp>
 #include "linalg.hpp"
 #include "cvCalibrationFork.hpp"
+#include <atomic>
 
 using namespace cv;
 
-static void subMatrix(const cv::Mat& src, cv::Mat& dst, const std::vector<uchar>& cols,
-                      const std::vector<uchar>& rows);
+static void subMatrix(const cv::Mat& src, cv::Mat& dst, const uchar* cols, const uchar* rows);
+static void computeStdDeviations(const Mat& intrinsicRows, const Mat& extrinsicBlocks, const uchar* mask,
+                                 double sigma2, bool withExtrinsics, Mat& stdDevs);
 static const char* cvDistCoeffErr = "Distortion coefficients must be 1x4, 4x1, 1x5, 5x1, 1x8, 8x1, 1x12, 12x1, 1x14 or 14x1 floating-point vector";
 
+namespace
+{
+std::atomic<cvfork::SolverStageHook> solverStageHook(nullptr);
+std::atomic<cvfork::SolverCounterHook> solverCounterHook(nullptr);
+
+class SolverTimer
+{
+    cvfork::SolverStage stage;
+    cvfork::SolverStageHook hook;
+    cvfork::SolverClock::time_point startPoint;
+public:
+    SolverTimer(cvfork::SolverStage _stage) :
+        stage(_stage), hook(solverStageHook.load(std::memory_order_relaxed))
+    {
+        if( hook )
+            startPoint = cvfork::SolverClock::now();
+    }
+    ~SolverTimer()
+    {
+        if( hook )
+            hook(stage, startPoint, cvfork::SolverClock::now());
+    }
+};
+
+void countSolverEvent(cvfork::SolverCounter counter, long long value)
+{
+    cvfork::SolverCounterHook hook = solverCounterHook.load(std::memory_order_relaxed);
+    if( hook )
+        hook(counter, value);
+}
+
+// returns a continuous matrix in the memory of buffer, the buffer only grows so that
+// the iterations and the following calibrations don't hit the allocator
+Mat getWorkspace(Mat& buffer, int rows, int cols, int type)
+{
+    size_t size = (size_t)rows*cols*CV_ELEM_SIZE(type);
+    if(buffer.total()*buffer.elemSize() < size)
+        buffer.create(1, (int)size, CV_8U);
+    return Mat(rows, cols, type, buffer.data);
+}
+
+// cost of the reprojection errors stored as (dx, dy) pairs under the robust loss of flags.
+// When the jacobians are given, their rows and the errors are scaled by the square root of
+// the IRLS weight of every point, so only the bad points lose their influence
+double robustCost(double* errors, int pointsNum, int flags, double scale, Mat* Ji = 0, Mat* Je = 0)
+{
+    double cost = 0, scale2 = scale*scale;
+    for( int j = 0; j < pointsNum; j++ )
+    {
+        double* e = errors + j*2;
+        double r2 = e[0]*e[0] + e[1]*e[1], weight = 1;
+        if( flags & CALIB_ROBUST_HUBER )
+        {
+            if( r2 > scale2 )
+            {
+                double r = std::sqrt(r2);
+                cost += 2*scale*r - scale2;
+                weight = scale / r;
+            }
+            else
+                cost += r2;
+        }
+        else if( flags & CALIB_ROBUST_CAUCHY )
+        {
+            cost += scale2*std::log(1 + r2/scale2);
+            weight = 1 / (1 + r2/scale2);
+        }
+        else
+            cost += r2;
+
+        if( Ji && weight < 1 )
+        {
+            double sw = std::sqrt(weight);
+            e[0] *= sw;
+            e[1] *= sw;
+            double* ji = Ji->ptr<double>(j*2);
+            for( int k = 0; k < Ji->cols*2; k++ )
+                ji[k] *= sw;
+            double* je = Je->ptr<double>(j*2);
+            for( int k = 0; k < Je->cols*2; k++ )
+                je[k] *= sw;
+        }
+    }
+    return cost;
+}
+
+// projects the points of a view and writes the errors and, when Ji is given, the derivatives
+// laid out as in cvProjectPoints2: Ji holds [f | c | k] in NINTRINSIC columns, Je holds [r | t]
+typedef void (*ProjectionKernel)(const Point3d* M, const Point2d* m, int count, const double* rvec,
+                                 const double* tvec, const double* A, const double* k, double aspectRatio,
+                                 bool calcFocal, bool calcCenter, double* err, double* Ji, double* Je);
+
+// derivative of the distorted point for a shift (dx, dy) of the normalized point
+template<bool rational, bool thinPrism, bool tangential, bool withK3>
+inline void distortionDerivative(double x, double y, double dx, double dy, double r2, double r4,
+                                 double cdist, double icdist2, const double* k, double& dmx, double& dmy)
+{
+    double dr2 = 2*x*dx + 2*y*dy;
+    double dcdist = k[0]*dr2 + 2*k[1]*r2*dr2 + (withK3 ? 3*k[4]*r4*dr2 : 0);
+    double dicdist2 = rational ? -icdist2*icdist2*(k[5]*dr2 + 2*k[6]*r2*dr2 + 3*k[7]*r4*dr2) : 0;
+    dmx = dx*cdist*icdist2 + x*dcdist*icdist2 + x*cdist*dicdist2;
+    dmy = dy*cdist*icdist2 + y*dcdist*icdist2 + y*cdist*dicdist2;
+    if( tangential )
+    {
+        double da1 = 2*(x*dy + y*dx);
+        dmx += k[2]*da1 + k[3]*(dr2 + 4*x*dx);
+        dmy += k[2]*(dr2 + 4*y*dy) + k[3]*da1;
+    }
+    if( thinPrism )
+    {
+        dmx += k[8]*dr2 + 2*r2*k[9]*dr2;
+        dmy += k[10]*dr2 + 2*r2*k[11]*dr2;
+    }
+}
+
+// cvProjectPoints2 without the tilt and with the terms of the inactive coefficients removed at compile time.
+// Without tangential or k3 terms those coefficients must be zero, their derivatives are still written
+template<bool rational, bool thinPrism, bool tangential, bool withK3>
+void projectView(const Point3d* M, const Point2d* m, int count, const double* rvec, const double* tvec,
+                 const double* A, const double* k, double aspectRatio, bool calcFocal, bool calcCenter,
+                 double* err, double* Ji, double* Je)
+{
+    const int NINTRINSIC = CV_CALIB_NINTRINSIC;
+    Matx33d R;
+    Matx<double, 3, 9> dRdr;
+    CvMat _r = cvMat(3, 1, CV_64F, (void*)rvec), matR = cvMat(3, 3, CV_64F, R.val);
+    CvMat matJ = cvMat(3, 9, CV_64F, dRdr.val);
+    cvRodrigues2( &_r, &matR, Ji ? &matJ : 0 );
+
+    double fy = A[4], fx = aspectRatio ? fy*aspectRatio : A[0], cx = A[2], cy = A[5];
+    const double* dR = dRdr.val;
+    for( int i = 0; i < count; i++ )
+    {
+        double X = M[i].x, Y = M[i].y, Z = M[i].z;
+        double x = R(0, 0)*X + R(0, 1)*Y + R(0, 2)*Z + tvec[0];
+        double y = R(1, 0)*X + R(1, 1)*Y + R(1, 2)*Z + tvec[1];
+        double z = R(2, 0)*X + R(2, 1)*Y + R(2, 2)*Z + tvec[2];
+        z = z ? 1./z : 1;
+        x *= z; y *= z;
+
+        double r2 = x*x + y*y, r4 = r2*r2, r6 = r4*r2;
+        double a1 = 2*x*y, a2 = r2 + 2*x*x, a3 = r2 + 2*y*y;
+        double cdist = 1 + k[0]*r2 + k[1]*r4 + (withK3 ? k[4]*r6 : 0);
+        double icdist2 = rational ? 1./(1 + k[5]*r2 + k[6]*r4 + k[7]*r6) : 1.;
+        double xd = x*cdist*icdist2, yd = y*cdist*icdist2;
+        if( tangential )
+        {
+            xd += k[2]*a1 + k[3]*a2;
+            yd += k[2]*a3 + k[3]*a1;
+        }
+        if( thinPrism )
+        {
+            xd += k[8]*r2 + k[9]*r4;
+            yd += k[10]*r2 + k[11]*r4;
+        }
+        err[i*2] = xd*fx + cx - m[i].x;
+        err[i*2 + 1] = yd*fy + cy - m[i].y;
+        if( !Ji )
+            continue;
+
+        double *jx = Ji + i*2*NINTRINSIC, *jy = jx + NINTRINSIC;
+        double *ex = Je + i*12, *ey = ex + 6;
+        if( calcFocal )
+        {
+            jx[0] = aspectRatio ? 0 : xd; jx[1] = aspectRatio ? xd*aspectRatio : 0;
+            jy[0] = 0; jy[1] = yd;
+        }
+        if( calcCenter )
+        {
+            jx[2] = 1; jx[3] = 0;
+            jy[2] = 0; jy[3] = 1;
+        }
+
+        double *kx = jx + 4, *ky = jy + 4;
+        kx[0] = fx*x*icdist2*r2; ky[0] = fy*y*icdist2*r2;
+        kx[1] = fx*x*icdist2*r4; ky[1] = fy*y*icdist2*r4;
+        kx[2] = fx*a1; ky[2] = fy*a3;
+        kx[3] = fx*a2; ky[3] = fy*a1;
+        kx[4] = fx*x*icdist2*r6; ky[4] = fy*y*icdist2*r6;
+        if( rational )
+        {
+            double c = -cdist*icdist2*icdist2;
+            kx[5] = fx*x*c*r2; ky[5] = fy*y*c*r2;
+            kx[6] = fx*x*c*r4; ky[6] = fy*y*c*r4;
+            kx[7] = fx*x*c*r6; ky[7] = fy*y*c*r6;
+        }
+        else
+            for( int j = 5; j < 8; j++ )
+                kx[j] = ky[j] = 0;
+        if( thinPrism )
+        {
+            kx[8] = fx*r2; ky[8] = 0;
+            kx[9] = fx*r4; ky[9] = 0;
+            kx[10] = 0; ky[10] = fy*r2;
+            kx[11] = 0; ky[11] = fy*r4;
+        }
+        else
+            for( int j = 8; j < 12; j++ )
+                kx[j] = ky[j] = 0;
+        kx[12] = kx[13] = ky[12] = ky[13] = 0;
+
+        const double dxdt[] = { z, 0, -x*z }, dydt[] = { 0, z, -y*z };
+        for( int j = 0; j < 3; j++ )
+        {
+            double dmx, dmy;
+            distortionDerivative<rational, thinPrism, tangential, withK3>(x, y, dxdt[j], dydt[j], r2, r4, cdist, icdist2, k, dmx, dmy);
+            ex[3 + j] = fx*dmx;
+            ey[3 + j] = fy*dmy;
+        }
+
+        for( int j = 0; j < 3; j++ )
+        {
+            const double* dRj = dR + j*9;
+            double dx0dr = X*dRj[0] + Y*dRj[1] + Z*dRj[2];
+            double dy0dr = X*dRj[3] + Y*dRj[4] + Z*dRj[5];
+            double dz0dr = X*dRj[6] + Y*dRj[7] + Z*dRj[8];
+            double dxdr = z*(dx0dr - x*dz0dr), dydr = z*(dy0dr - y*dz0dr);
+            double dmx, dmy;
+            distortionDerivative<rational, thinPrism, tangential, withK3>(x, y, dxdr, dydr, r2, r4, cdist, icdist2, k, dmx, dmy);
+            ex[j] = fx*dmx;
+            ey[j] = fy*dmy;
+        }
+    }
+}
+
+template<bool rational, bool thinPrism, bool tangential>
+ProjectionKernel selectK3Kernel(bool withK3)
+{
+    return withK3 ? projectView<rational, thinPrism, tangential, true> :
+                    projectView<rational, thinPrism, tangential, false>;
+}
+
+template<bool rational, bool thinPrism>
+ProjectionKernel selectTangentialKernel(bool tangential, bool withK3)
+{
+    return tangential ? selectK3Kernel<rational, thinPrism, true>(withK3) :
+                        selectK3Kernel<rational, thinPrism, false>(withK3);
+}
+
+bool hasNonzeroCoeffs(const double* k, int first, int last)
+{
+    for( int i = first; i <= last; i++ )
+        if( k[i] != 0 )
+            return true;
+    return false;
+}
+
+// chosen once per solve by the distortion model and the fixed coefficients, k is the initial
+// distortion. The tilted model has no kernel and is projected by cvProjectPoints2
+ProjectionKernel selectProjectionKernel(int flags, const double* k)
+{
+    // the coefficients of a disabled model are fixed, but keep the nonzero values of an intrinsic guess
+    if( (flags & CALIB_TILTED_MODEL) || hasNonzeroCoeffs(k, 12, 13) )
+        return 0;
+    // CALIB_ZERO_TANGENT_DIST zeroes p1 and p2, while a fixed k3 keeps the value of the guess
+    bool tangential = !(flags & CALIB_ZERO_TANGENT_DIST);
+    bool withK3 = !(flags & CALIB_FIX_K3) || k[4] != 0;
+    bool rational = (flags & CALIB_RATIONAL_MODEL) || hasNonzeroCoeffs(k, 5, 7);
+    bool thinPrism = (flags & CALIB_THIN_PRISM_MODEL) || hasNonzeroCoeffs(k, 8, 11);
+    if( rational )
+        return thinPrism ? selectTangentialKernel<true, true>(tangential, withK3) :
+                           selectTangentialKernel<true, false>(tangential, withK3);
+    return thinPrism ? selectTangentialKernel<false, true>(tangential, withK3) :
+                       selectTangentialKernel<false, false>(tangential, withK3);
+}
+
+class ViewsAccumulator : public ParallelLoopBody
+{
+    const CvMat* param;
+    const Mat& objPoints;
+    const Mat& imgPoints;
+    Mat& allErrors;
+    const std::vector<int>& offsets;
+    const CvMat* cameraMatrix;
+    const CvMat* distCoeffs;
+    ProjectionKernel kernel;
+    int flags;
+    double aspectRatio;
+    double lossScale;
+    int maxPoints;
+    bool calcJ;
+    bool storeErrors;
+    Mat& JtJ;
+    Mat& JtErr;
+    Mat& viewJtJ;
+    Mat& viewJtErr;
+    std::vector<double>& viewErrNorms;
+    std::vector<double>& viewSquaredErrors;
+public:
+    ViewsAccumulator(const CvMat* _param, const Mat& _objPoints, const Mat& _imgPoints, Mat& _allErrors,
+                     const std::vector<int>& _offsets, const CvMat* _cameraMatrix, const CvMat* _distCoeffs,
+                     ProjectionKernel _kernel, int _flags, double _aspectRatio, double _lossScale, int _maxPoints, bool _calcJ, bool _storeErrors,
+                     Mat& _JtJ, Mat& _JtErr, Mat& _viewJtJ, Mat& _viewJtErr, std::vector<double>& _viewErrNorms,
+                     std::vector<double>& _viewSquaredErrors) :
+        param(_param), objPoints(_objPoints), imgPoints(_imgPoints), allErrors(_allErrors), offsets(_offsets),
+        cameraMatrix(_cameraMatrix), distCoeffs(_distCoeffs), kernel(_kernel), flags(_flags), aspectRatio(_aspectRatio),
+        lossScale(_lossScale), maxPoints(_maxPoints), calcJ(_calcJ), storeErrors(_storeErrors), JtJ(_JtJ), JtErr(_JtErr),
+        viewJtJ(_viewJtJ), viewJtErr(_viewJtErr), viewErrNorms(_viewErrNorms),
+        viewSquaredErrors(_viewSquaredErrors)
+    {}
+
+    void operator()(const Range& range) const
+    {
+        const int NINTRINSIC = CV_CALIB_NINTRINSIC;
+        static thread_local Mat jiBuffer, jeBuffer, errBuffer;
+        Mat Ji = getWorkspace(jiBuffer, maxPoints*2, NINTRINSIC, CV_64FC1);
+        Mat Je = getWorkspace(jeBuffer, maxPoints*2, 6, CV_64FC1);
+        Mat err = getWorkspace(errBuffer, maxPoints*2, 1, CV_64FC1);
+        // the workspace keeps the values of the earlier solves, and the derivatives of the fixed
+        // parameters and of the unused coefficients are not written, so they are cleared first
+        if( calcJ )
+            Ji = Scalar(0);
+
+        for( int i = range.start; i < range.end; i++ )
+        {
+            CvMat _ri, _ti;
+            int pos = offsets[i], ni = offsets[i + 1] - offsets[i];
+
+            cvGetRows( param, &_ri, NINTRINSIC + i*6, NINTRINSIC + i*6 + 3 );
+            cvGetRows( param, &_ti, NINTRINSIC + i*6 + 3, NINTRINSIC + i*6 + 6 );
+
+            CvMat _Mi(objPoints.colRange(pos, pos + ni));
+            CvMat _mi(imgPoints.colRange(pos, pos + ni));
+            CvMat _me(allErrors.colRange(pos, pos + ni));
+
+            Mat _Je = Je.rowRange(0, ni*2), _Ji = Ji.rowRange(0, ni*2), _err = err.rowRange(0, ni*2);
+            CvMat _dpdr(_Je.colRange(0, 3));
+            CvMat _dpdt(_Je.colRange(3, 6));
+            CvMat _dpdf(_Ji.colRange(0, 2));
+            CvMat _dpdc(_Ji.colRange(2, 4));
+            CvMat _dpdk(_Ji.colRange(4, NINTRINSIC));
+            CvMat _mp(_err.reshape(2, 1));
+
+            if( kernel )
+                kernel( objPoints.ptr<Point3d>() + pos, imgPoints.ptr<Point2d>() + pos, ni, _ri.data.db, _ti.data.db,
+                        cameraMatrix->data.db, distCoeffs->data.db, (flags & CALIB_FIX_ASPECT_RATIO) ? aspectRatio : 0,
+                        !(flags & CALIB_FIX_FOCAL_LENGTH), !(flags & CALIB_FIX_PRINCIPAL_POINT), _err.ptr<double>(),
+                        calcJ ? _Ji.ptr<double>() : 0, calcJ ? _Je.ptr<double>() : 0 );
+            else
+            {
+                if( calcJ )
+                {
+                     cvProjectPoints2( &_Mi, &_ri, &_ti, cameraMatrix, distCoeffs, &_mp, &_dpdr, &_dpdt,
+                                      (flags & CALIB_FIX_FOCAL_LENGTH) ? 0 : &_dpdf,
+                                      (flags & CALIB_FIX_PRINCIPAL_POINT) ? 0 : &_dpdc, &_dpdk,
+                                      (flags & CALIB_FIX_ASPECT_RATIO) ? aspectRatio : 0);
+                }
+                else
+                    cvProjectPoints2( &_Mi, &_ri, &_ti, cameraMatrix, distCoeffs, &_mp );
+
+                cvSub( &_mp, &_mi, &_mp );
+            }
+            if( calcJ && storeErrors )
+                cvCopy(&_mp, &_me);
+
+            // the weights follow the current errors, so they are updated at every evaluation.
+            // The robust cost only drives the solver, the reported errors stay in pixels
+            viewSquaredErrors[i] = norm(_err, NORM_L2SQR);
+            if( flags & (CALIB_ROBUST_HUBER | CALIB_ROBUST_CAUCHY) )
+                viewErrNorms[i] = robustCost(_err.ptr<double>(), ni, flags, lossScale,
+                                             calcJ ? &_Ji : 0, calcJ ? &_Je : 0);
+            else
+                viewErrNorms[i] = viewSquaredErrors[i];
+
+            if( calcJ )
+            {
+                // see HZ: (A6.14) for details on the structure of the Jacobian
+                // the products are written in place to avoid temporary matrices
+                Mat Aii = viewJtJ.rowRange(i*NINTRINSIC, (i + 1)*NINTRINSIC);
+                Mat Bii = JtJ(Rect(NINTRINSIC + i * 6, NINTRINSIC + i * 6, 6, 6));
+                Mat Cii = JtJ(Rect(NINTRINSIC + i * 6, 0, 6, NINTRINSIC));
+                Mat ei = viewJtErr.rowRange(i*NINTRINSIC, (i + 1)*NINTRINSIC);
+                Mat ee = JtErr.rowRange(NINTRINSIC + i * 6, NINTRINSIC + (i + 1) * 6);
+                gemm(_Ji, _Ji, 1, noArray(), 0, Aii, GEMM_1_T);
+                gemm(_Je, _Je, 1, noArray(), 0, Bii, GEMM_1_T);
+                gemm(_Ji, _Je, 1, noArray(), 0, Cii, GEMM_1_T);
+                gemm(_Ji, _err, 1, noArray(), 0, ei, GEMM_1_T);
+                gemm(_Je, _err, 1, noArray(), 0, ee, GEMM_1_T);
+            }
+        }
+    }
+};
+}
+
+void cvfork::setSolverHooks(SolverStageHook stageHook, SolverCounterHook counterHook)
+{
+    solverStageHook = stageHook;
+    solverCounterHook = counterHook;
+}
+
+double cvfork::checkProjectionKernel(InputArray _objectPoints, InputArray _rvec, InputArray _tvec,
+                                     InputArray _cameraMatrix, InputArray _distCoeffs, int flags,
+                                     double& projectionError)
+{
+    const int NINTRINSIC = CV_CALIB_NINTRINSIC;
+    Mat objPt;
+    _objectPoints.getMat().convertTo(objPt, CV_64F);
+    int count = objPt.checkVector(3, CV_64F);
+    CV_Assert( count > 0 );
+    objPt = objPt.reshape(3, count);
+
+    Mat cameraMatrix, distCoeffs, rvec, tvec;
+    _cameraMatrix.getMat().convertTo(cameraMatrix, CV_64F);
+    _distCoeffs.getMat().convertTo(distCoeffs, CV_64F);
+    _rvec.getMat().convertTo(rvec, CV_64F);
+    _tvec.getMat().convertTo(tvec, CV_64F);
+    CV_Assert( cameraMatrix.size() == Size(3, 3) && distCoeffs.total() <= 14 && rvec.total() == 3 && tvec.total() == 3 );
+
+    double A[9], k[14] = { 0 }, rt[6];
+    std::copy(cameraMatrix.ptr<double>(), cameraMatrix.ptr<double>() + 9, A);
+    std::copy(distCoeffs.ptr<double>(), distCoeffs.ptr<double>() + distCoeffs.total(), k);
+    std::copy(rvec.ptr<double>(), rvec.ptr<double>() + 3, rt);
+    std::copy(tvec.ptr<double>(), tvec.ptr<double>() + 3, rt + 3);
+    // the solver zeroes the tangential distortion before the kernel is chosen
+    if( flags & CALIB_ZERO_TANGENT_DIST )
+        k[2] = k[3] = 0;
+
+    ProjectionKernel kernel = selectProjectionKernel(flags, k);
+    if( !kernel )
+        CV_Error( CV_StsBadArg, "The tilted model is projected by cvProjectPoints2, it has no kernel to check" );
+
+    // zero image points turn the errors into the projections
+    std::vector<Point2d> zeros(count);
+    Mat err(count*2, 1, CV_64F), errPlus(count*2, 1, CV_64F), errMinus(count*2, 1, CV_64F);
+    Mat Ji(count*2, NINTRINSIC, CV_64F, Scalar(0)), Je(count*2, 6, CV_64F);
+    kernel( objPt.ptr<Point3d>(), &zeros[0], count, rt, rt + 3, A, k, 0, true, true,
+            err.ptr<double>(), Ji.ptr<double>(), Je.ptr<double>() );
+
+    Mat projected;
+    projectPoints( objPt, Mat(3, 1, CV_64F, rt), Mat(3, 1, CV_64F, rt + 3), cameraMatrix,
+                   Mat(1, 14, CV_64F, k), projected );
+    projectionError = 0;
+    for( int i = 0; i < count; i++ )
+        projectionError = std::max(projectionError, norm(projected.at<Point2d>(i) -
+                                                         Point2d(err.at<double>(i*2), err.at<double>(i*2 + 1))));
+
+    // the intrinsics in the Ji column order, then the extrinsics of Je
+    double* params[NINTRINSIC + 6] = { A, A + 4, A + 2, A + 5 };
+    for( int j = 0; j < 14; j++ )
+        params[4 + j] = k + j;
+    for( int j = 0; j < 6; j++ )
+        params[NINTRINSIC + j] = rt + j;
+
+    // the columns of the fixed parameters are masked by the solver and not checked
+    uchar mask[NINTRINSIC + 6];
+    std::fill(mask, mask + NINTRINSIC + 6, 1);
+    mask[0] = mask[1] = !(flags & CALIB_FIX_FOCAL_LENGTH);
+    mask[2] = mask[3] = !(flags & CALIB_FIX_PRINCIPAL_POINT);
+    mask[4] = !(flags & CALIB_FIX_K1);
+    mask[5] = !(flags & CALIB_FIX_K2);
+    mask[6] = mask[7] = !(flags & CALIB_ZERO_TANGENT_DIST);
+    mask[8] = !(flags & CALIB_FIX_K3);
+    mask[9] = (flags & CALIB_RATIONAL_MODEL) && !(flags & CALIB_FIX_K4);
+    mask[10] = (flags & CALIB_RATIONAL_MODEL) && !(flags & CALIB_FIX_K5);
+    mask[11] = (flags & CALIB_RATIONAL_MODEL) && !(flags & CALIB_FIX_K6);
+    for( int j = 12; j < 16; j++ )
+        mask[j] = (flags & CALIB_THIN_PRISM_MODEL) && !(flags & CALIB_FIX_S1_S2_S3_S4);
+    mask[16] = mask[17] = 0;
+
+    double maxError = 0;
+    for( int j = 0; j < NINTRINSIC + 6; j++ )
+    {
+        if( !mask[j] )
+            continue;
+        double value = *params[j], h = 1e-6*std::max(std::fabs(value), 1.);
+        *params[j] = value + h;
+        kernel( objPt.ptr<Point3d>(), &zeros[0], count, rt, rt + 3, A, k, 0, true, true, errPlus.ptr<double>(), 0, 0 );
+        *params[j] = value - h;
+        kernel( objPt.ptr<Point3d>(), &zeros[0], count, rt, rt + 3, A, k, 0, true, true, errMinus.ptr<double>(), 0, 0 );
+        *params[j] = value;
+
+        for( int i = 0; i < count*2; i++ )
+        {
+            double numeric = (errPlus.at<double>(i) - errMinus.at<double>(i))/(2*h);
+            double analytic = j < NINTRINSIC ? Ji.at<double>(i, j) : Je.at<double>(i, j - NINTRINSIC);
+            maxError = std::max(maxError, std::fabs(analytic - numeric)/std::max(std::fabs(numeric), 1.));
+        }
+    }
+    return maxError;
+}
+
 double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
                     const CvMat* imagePoints, const CvMat* npoints,
                     CvSize imageSize, CvMat* cameraMatrix, CvMat* distCoeffs,
-                    CvMat* rvecs, CvMat* tvecs, CvMat* stdDevs, CvMat* perViewErrors, int flags, CvTermCriteria termCrit )
+                    CvMat* rvecs, CvMat* tvecs, CvMat* stdDevs, CvMat* perViewErrors, int flags, CvTermCriteria termCrit,
+                    double lossScale )
 {
     const int NINTRINSIC = CV_CALIB_NINTRINSIC;
     double reprojErr = 0;
@@ -30,6 +514,9 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
     if( imageSize.width <= 0 || imageSize.height <= 0 )
         CV_Error( CV_StsOutOfRange, "image width and height must be positive" );
 
+    if( (flags & (CALIB_ROBUST_HUBER | CALIB_ROBUST_CAUCHY)) && lossScale <= 0 )
+        CV_Error( CV_StsOutOfRange, "the scale of the robust loss must be positive" );
+
     if( CV_MAT_TYPE(npoints->type) != CV_32SC1 ||
         (npoints->rows != 1 && npoints->cols != 1) )
         CV_Error( CV_StsUnsupportedFormat,
@@ -111,8 +598,10 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
         total += ni;
     }
 
-    Mat matM( 1, total, CV_64FC3 );
-    Mat _m( 1, total, CV_64FC2 );
+    // the buffers are kept between the calibrations of the calling thread
+    static thread_local Mat objectBuffer, imageBuffer, viewJtJBuffer, viewJtErrBuffer, errorsBuffer;
+    Mat matM = getWorkspace(objectBuffer, 1, total, CV_64FC3);
+    Mat _m = getWorkspace(imageBuffer, 1, total, CV_64FC2);
 
     if(CV_MAT_CN(objectPoints->type) == 3) {
         cvarrToMat(objectPoints).convertTo(matM, CV_64F);
@@ -127,9 +616,12 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
     }
 
     nparams = NINTRINSIC + nimages*6;
-    Mat _Ji( maxPoints*2, NINTRINSIC, CV_64FC1, Scalar(0));
-    Mat _Je( maxPoints*2, 6, CV_64FC1 );
-    Mat _err( maxPoints*2, 1, CV_64FC1 );
+    Mat viewJtJ = getWorkspace(viewJtJBuffer, nimages*NINTRINSIC, NINTRINSIC, CV_64FC1);
+    Mat viewJtErr = getWorkspace(viewJtErrBuffer, nimages*NINTRINSIC, 1, CV_64FC1);
+    std::vector<double> viewErrNorms(nimages), viewSquaredErrors(nimages);
+    std::vector<int> viewOffsets(nimages + 1, 0);
+    for( i = 0; i < nimages; i++ )
+        viewOffsets[i + 1] = viewOffsets[i] + npoints->data.i[i*npstep];
 
     _k = cvMat( distCoeffs->rows, distCoeffs->cols, CV_MAKETYPE(CV_64F,CV_MAT_CN(distCoeffs->type)), k);
     if( distCoeffs->rows*distCoeffs->cols*CV_MAT_CN(distCoeffs->type) < 8 )
@@ -193,13 +685,17 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
 
     //CvLevMarq solver( nparams, 0, termCrit );
     cvfork::CvLevMarqFork solver( nparams, 0, termCrit );
-    Mat JtJcopy, allErrors(1, total, CV_64FC2);
+    Mat JtJIntrinsicRows, JtJExtrinsicBlocks, allErrors = getWorkspace(errorsBuffer, 1, total, CV_64FC2);
 
     if(flags & CALIB_USE_LU) {
         solver.solveMethod = DECOMP_LU;
     }
     else if(flags & CALIB_USE_QR)
         solver.solveMethod = DECOMP_QR;
+    else if(flags & CALIB_USE_CHOLESKY)
+        solver.solveMethod = DECOMP_CHOLESKY;
+    if(flags & CALIB_USE_SCHUR)
+        solver.enableSchurComplement(NINTRINSIC);
 
     {
     double* param = solver.param->data.db;
@@ -254,6 +750,32 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
         cvGetRows( solver.param, &_ri, NINTRINSIC + i*6, NINTRINSIC + i*6 + 3 );
         cvGetRows( solver.param, &_ti, NINTRINSIC + i*6 + 3, NINTRINSIC + i*6 + 6 );
 
+        if( (flags & CALIB_USE_INITIAL_EXTRINSICS) && rvecs && tvecs )
+        {
+            CvMat src;
+            if( rvecs->rows == nimages && rvecs->cols*CV_MAT_CN(rvecs->type) == 9 )
+            {
+                src = cvMat( 3, 3, CV_MAT_DEPTH(rvecs->type),
+                    rvecs->data.ptr + rvecs->step*i );
+                cvRodrigues2( &src, &_ri );
+            }
+            else
+            {
+                src = cvMat( 3, 1, CV_MAT_DEPTH(rvecs->type), rvecs->rows == 1 ?
+                    rvecs->data.ptr + i*CV_ELEM_SIZE(rvecs->type) :
+                    rvecs->data.ptr + rvecs->step*i );
+                cvConvert( &src, &_ri );
+            }
+            src = cvMat( 3, 1, CV_MAT_DEPTH(tvecs->type), tvecs->rows == 1 ?
+                tvecs->data.ptr + i*CV_ELEM_SIZE(tvecs->type) :
+                tvecs->data.ptr + tvecs->step*i );
+            cvConvert( &src, &_ti );
+
+            // views without a previous pose are marked by a zero translation
+            if( cvNorm( &_ti ) > 0 )
+                continue;
+        }
+
         CvMat _Mi(matM.colRange(pos, pos + ni));
         CvMat _mi(_m.colRange(pos, pos + ni));
 
@@ -261,12 +783,17 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
     }
 
     // 3. run the optimization
+    ProjectionKernel projectionKernel = selectProjectionKernel(flags, solver.param->data.db + 4);
     for(;;)
     {
         const CvMat* _param = 0;
         CvMat *_JtJ = 0, *_JtErr = 0;
         double* _errNorm = 0;
-        bool proceed = solver.updateAlt( _param, _JtJ, _JtErr, _errNorm );
+        bool proceed;
+        {
+            SolverTimer timer(cvfork::SOLVER_STAGE_STEP);
+            proceed = solver.updateAlt( _param, _JtJ, _JtErr, _errNorm );
+        }
         double *param = solver.param->data.db, *pparam = solver.prevParam->data.db;
 
         if( flags & CALIB_FIX_ASPECT_RATIO )
@@ -280,89 +807,57 @@ double cvfork::cvCalibrateCamera2( const CvMat* objectPoints,
 
         if( !proceed ) {
             //do errors estimation
-            if(JtJcopy.total() && stdDevs) {
-                Mat mask = cvarrToMat(solver.mask);
-                int nparams_nz = countNonZero(mask);
-                Mat JtJinv, JtJN;
-                JtJN.create(nparams_nz, nparams_nz, CV_64F);
-                subMatrix(JtJcopy, JtJN, mask, mask);
-                completeSymm(JtJN, false);
-#ifndef USE_LAPACK
-                cv::invert(JtJN, JtJinv, DECOMP_SVD);
-#else
-                cvfork::invert(JtJN, JtJinv, DECOMP_SVD);
-#endif
+            if(JtJIntrinsicRows.total() && stdDevs) {
+                int nparams_nz = countNonZero(cvarrToMat(solver.mask));
                 double sigma2 = norm(allErrors, NORM_L2SQR) / (total - nparams_nz);
                 Mat stdDevsM = cvarrToMat(stdDevs);
-                int j = 0;
-                for (int i = 0; i < nparams; i++)
-                    if(mask.data[i]) {
-                        stdDevsM.at<double>(i) = std::sqrt(JtJinv.at<double>(j,j)*sigma2);
-                        j++;
-                    }
-                    else
-                        stdDevsM.at<double>(i) = 0;
+                computeStdDeviations(JtJIntrinsicRows, JtJExtrinsicBlocks, solver.mask->data.ptr, sigma2,
+                                     (flags & CALIB_EXTRINSIC_STD_DEVIATIONS) != 0, stdDevsM);
             }
             break;
         }
 
         reprojErr = 0;
+        double solverErr = 0;
 
-        for( i = 0, pos = 0; i < nimages; i++, pos += ni )
+        bool calcJ = solver.state == CvLevMarq::CALC_J;
+        Mat JtJ, JtErr;
+        if( calcJ )
         {
-            CvMat _ri, _ti;
-            ni = npoints->data.i[i*npstep];
-
-            cvGetRows( solver.param, &_ri, NINTRINSIC + i*6, NINTRINSIC + i*6 + 3 );
-            cvGetRows( solver.param, &_ti, NINTRINSIC + i*6 + 3, NINTRINSIC + i*6 + 6 );
-
-            CvMat _Mi(matM.colRange(pos, pos + ni));
-            CvMat _mi(_m.colRange(pos, pos + ni));
-            CvMat _me(allErrors.colRange(pos, pos + ni));
-
-            _Je.resize(ni*2); _Ji.resize(ni*2); _err.resize(ni*2);
-            CvMat _dpdr(_Je.colRange(0, 3));
-            CvMat _dpdt(_Je.colRange(3, 6));
-            CvMat _dpdf(_Ji.colRange(0, 2));
-            CvMat _dpdc(_Ji.colRange(2, 4));
-            CvMat _dpdk(_Ji.colRange(4, NINTRINSIC));
-            CvMat _mp(_err.reshape(2, 1));
-
-            if( solver.state == CvLevMarq::CALC_J )
-            {
-                 cvProjectPoints2( &_Mi, &_ri, &_ti, &matA, &_k, &_mp, &_dpdr, &_dpdt,
-                                  (flags & CALIB_FIX_FOCAL_LENGTH) ? 0 : &_dpdf,
-                                  (flags & CALIB_FIX_PRINCIPAL_POINT) ? 0 : &_dpdc, &_dpdk,
-                                  (flags & CALIB_FIX_ASPECT_RATIO) ? aspectRatio : 0);
-            }
-            else
-                cvProjectPoints2( &_Mi, &_ri, &_ti, &matA, &_k, &_mp );
-
-            cvSub( &_mp, &_mi, &_mp );
-
-            if( solver.state == CvLevMarq::CALC_J )
+            JtJ = cvarrToMat(_JtJ);
+            JtErr = cvarrToMat(_JtErr);
+            countSolverEvent(cvfork::SOLVER_COUNTER_JACOBIANS, 1);
+        }
+        SolverTimer accumulationTimer(calcJ ? cvfork::SOLVER_STAGE_JACOBIAN : cvfork::SOLVER_STAGE_ERROR);
+        parallel_for_(Range(0, nimages), ViewsAccumulator(solver.param, matM, _m, allErrors, viewOffsets,
+                                                          &matA, &_k, projectionKernel, flags, aspectRatio, lossScale, maxPoints, calcJ,
+                                                          stdDevs != 0, JtJ, JtErr, viewJtJ, viewJtErr,
+                                                          viewErrNorms, viewSquaredErrors));
+
+        // the intrinsic blocks are reduced in view order to keep results independent of threading
+        for( i = 0; i < nimages; i++ )
+        {
+            if( calcJ )
             {
-                Mat JtJ(cvarrToMat(_JtJ)), JtErr(cvarrToMat(_JtErr));
-
-                // see HZ: (A6.14) for details on the structure of the Jacobian
-                JtJ(Rect(0, 0, NINTRINSIC, NINTRINSIC)) += _Ji.t() * _Ji;
-                JtJ(Rect(NINTRINSIC + i * 6, NINTRINSIC + i * 6, 6, 6)) = _Je.t() * _Je;
-                JtJ(Rect(NINTRINSIC + i * 6, 0, 6, NINTRINSIC)) = _Ji.t() * _Je;
-
-                JtErr.rowRange(0, NINTRINSIC) += _Ji.t() * _err;
-                JtErr.rowRange(NINTRINSIC + i * 6, NINTRINSIC + (i + 1) * 6) = _Je.t() * _err;
-                if (stdDevs)
-                    cvCopy(&_mp, &_me);
+                JtJ(Rect(0, 0, NINTRINSIC, NINTRINSIC)) += viewJtJ.rowRange(i*NINTRINSIC, (i + 1)*NINTRINSIC);
+                JtErr.rowRange(0, NINTRINSIC) += viewJtErr.rowRange(i*NINTRINSIC, (i + 1)*NINTRINSIC);
             }
-
-            reprojErr += norm(_err, NORM_L2SQR);
+            solverErr += viewErrNorms[i];
+            reprojErr += viewSquaredErrors[i];
+        }
+        if(solver.state == CvLevMarq::CALC_J && stdDevs) {
+            // only the intrinsic rows and the diagonal extrinsic blocks are needed for the covariance
+            JtJ.rowRange(0, NINTRINSIC).copyTo(JtJIntrinsicRows);
+            JtJExtrinsicBlocks.create(nimages*6, 6, CV_64F);
+            for( i = 0; i < nimages; i++ )
+                JtJ(Rect(NINTRINSIC + i*6, NINTRINSIC + i*6, 6, 6)).copyTo(JtJExtrinsicBlocks.rowRange(i*6, i*6 + 6));
         }
-        if(solver.state == CvLevMarq::CALC_J && stdDevs)
-            cvarrToMat(_JtJ).copyTo(JtJcopy);
         if( _errNorm )
-            *_errNorm = reprojErr;
+            *_errNorm = solverErr;
     }
 
+    countSolverEvent(cvfork::SOLVER_COUNTER_ITERATIONS, solver.iters);
+
     // 4. store the results
     cvConvert( &matA, cameraMatrix );
     cvConvert( &_k, distCoeffs );
@@ -437,6 +932,21 @@ static Mat prepareDistCoeffs(Mat& distCoeffs0, int rtype)
     return distCoeffs;
 }
 
+static void collectInitialVectors(InputArrayOfArrays vecs, int nimages, Mat& dst)
+{
+    dst = Mat::zeros(nimages, 3, CV_64F);
+    int n = std::min((int)vecs.total(), nimages);
+    for(int i = 0; i < n; i++)
+    {
+        Mat v = vecs.getMat(i);
+        if( v.total()*v.channels() == 3 )
+        {
+            Mat row = dst.row(i);
+            v.reshape(1, 1).convertTo(row, CV_64F);
+        }
+    }
+}
+
 static void collectCalibrationData( InputArrayOfArrays objectPoints,
                                     InputArrayOfArrays imagePoints1,
                                     InputArrayOfArrays imagePoints2,
@@ -497,7 +1007,24 @@ static void collectCalibrationData( InputArrayOfArrays objectPoints,
 double cvfork::calibrateCamera(InputArrayOfArrays _objectPoints,
                             InputArrayOfArrays _imagePoints,
                             Size imageSize, InputOutputArray _cameraMatrix, InputOutputArray _distCoeffs,
-                            OutputArrayOfArrays _rvecs, OutputArrayOfArrays _tvecs, OutputArray _stdDeviations, OutputArray _perViewErrors, int flags, TermCriteria criteria )
+                            OutputArrayOfArrays _rvecs, OutputArrayOfArrays _tvecs, OutputArray _stdDeviations, OutputArray _perViewErrors, int flags, TermCriteria criteria,
+                            double lossScale )
+{
+    int nimages = int(_objectPoints.total());
+    CV_Assert( nimages > 0 );
+    Mat objPt, imgPt, npoints;
+
+    collectCalibrationData( _objectPoints, _imagePoints, noArray(),
+                            objPt, imgPt, 0, npoints );
+
+    return calibrateCameraPacked(objPt, imgPt, npoints, imageSize, _cameraMatrix, _distCoeffs,
+                                 _rvecs, _tvecs, _stdDeviations, _perViewErrors, flags, criteria, lossScale);
+}
+
+double cvfork::calibrateCameraPacked(InputArray _objectPoints, InputArray _imagePoints, InputArray _npoints,
+                            Size imageSize, InputOutputArray _cameraMatrix, InputOutputArray _distCoeffs,
+                            OutputArrayOfArrays _rvecs, OutputArrayOfArrays _tvecs, OutputArray _stdDeviations, OutputArray _perViewErrors, int flags, TermCriteria criteria,
+                            double lossScale )
 {
     int rtype = CV_64F;
     Mat cameraMatrix = _cameraMatrix.getMat();
@@ -509,9 +1036,11 @@ double cvfork::calibrateCamera(InputArrayOfArrays _objectPoints,
     (!(flags & CALIB_TILTED_MODEL)))
         distCoeffs = distCoeffs.rows == 1 ? distCoeffs.colRange(0, 5) : distCoeffs.rowRange(0, 5);
 
-    int nimages = int(_objectPoints.total());
-    CV_Assert( nimages > 0 );
-    Mat objPt, imgPt, npoints, rvecM, tvecM, stdDeviationsM, errorsM;
+    Mat objPt = _objectPoints.getMat(), imgPt = _imagePoints.getMat(), npoints = _npoints.getMat();
+    int nimages = int(npoints.total());
+    CV_Assert( nimages > 0 && npoints.type() == CV_32S && npoints.isContinuous() );
+    CV_Assert( objPt.checkVector(3, CV_32F) == (int)sum(npoints)[0] && imgPt.checkVector(2, CV_32F) == objPt.checkVector(3, CV_32F) );
+    Mat rvecM, tvecM, stdDeviationsM, errorsM;
 
     bool rvecs_needed = _rvecs.needed(), tvecs_needed = _tvecs.needed(),
             stddev_needed = _stdDeviations.needed(), errors_needed = _perViewErrors.needed();
@@ -523,6 +1052,15 @@ double cvfork::calibrateCamera(InputArrayOfArrays _objectPoints,
     CV_Assert( !stddev_vec );
     CV_Assert( !errors_vec );
 
+    Mat rvecInit, tvecInit;
+    bool extrinsics_guess = (flags & CALIB_USE_INITIAL_EXTRINSICS) && rvecs_needed && tvecs_needed;
+    if( extrinsics_guess ) {
+        collectInitialVectors(_rvecs, nimages, rvecInit);
+        collectInitialVectors(_tvecs, nimages, tvecInit);
+    }
+    else
+        flags &= ~CALIB_USE_INITIAL_EXTRINSICS;
+
     if( rvecs_needed ) {
         _rvecs.create(nimages, 1, CV_64FC3);
 
@@ -541,6 +1079,12 @@ double cvfork::calibrateCamera(InputArrayOfArrays _objectPoints,
             tvecM = _tvecs.getMat();
     }
 
+    if( extrinsics_guess ) {
+        Mat rvecDst = rvecM.reshape(1, nimages), tvecDst = tvecM.reshape(1, nimages);
+        rvecInit.copyTo(rvecDst);
+        tvecInit.copyTo(tvecDst);
+    }
+
     if( stddev_needed ) {
         _stdDeviations.create(nimages*6 + CV_CALIB_NINTRINSIC, 1, CV_64F);
 
@@ -559,8 +1103,6 @@ double cvfork::calibrateCamera(InputArrayOfArrays _objectPoints,
             errorsM = _perViewErrors.getMat();
     }
 
-    collectCalibrationData( _objectPoints, _imagePoints, noArray(),
-                            objPt, imgPt, 0, npoints );
     CvMat c_objPt = objPt, c_imgPt = imgPt, c_npoints = npoints;
     CvMat c_cameraMatrix = cameraMatrix, c_distCoeffs = distCoeffs;
     CvMat c_rvecM = rvecM, c_tvecM = tvecM, c_stdDev = stdDeviationsM, c_errors = errorsM;
@@ -570,7 +1112,7 @@ double cvfork::calibrateCamera(InputArrayOfArrays _objectPoints,
                                           rvecs_needed ? &c_rvecM : NULL,
                                           tvecs_needed ? &c_tvecM : NULL,
                                           stddev_needed ? &c_stdDev : NULL,
-                                          errors_needed ? &c_errors : NULL, flags, criteria );
+                                          errors_needed ? &c_errors : NULL, flags, criteria, lossScale );
 
     // overly complicated and inefficient rvec/ tvec handling to support vector<Mat>
     for(int i = 0; i < nimages; i++ )
@@ -623,26 +1165,136 @@ double cvfork::calibrateCameraCharuco(InputArrayOfArrays _charucoCorners, InputA
 }
 
 
-static void subMatrix(const cv::Mat& src, cv::Mat& dst, const std::vector<uchar>& cols,
-                      const std::vector<uchar>& rows) {
-    int nonzeros_cols = cv::countNonZero(cols);
-    cv::Mat tmp(src.rows, nonzeros_cols, CV_64FC1);
+// copies the elements of src in the rows and the columns selected by the masks,
+// all columns are copied when cols is empty
+static void subMatrix(const cv::Mat& src, cv::Mat& dst, const uchar* cols, const uchar* rows)
+{
+    int nonzeros_rows = 0, nonzeros_cols = 0;
+    for (int i = 0; i < src.rows; i++)
+        nonzeros_rows += rows[i] != 0;
+    for (int i = 0; i < src.cols; i++)
+        nonzeros_cols += !cols || cols[i];
 
-    for (int i = 0, j = 0; i < (int)cols.size(); i++)
+    dst.create(nonzeros_rows, nonzeros_cols, CV_64FC1);
+    for (int i = 0, r = 0; i < src.rows; i++)
     {
-        if (cols[i])
-        {
-            src.col(i).copyTo(tmp.col(j++));
+        if (!rows[i])
+            continue;
+        const double* srcRow = src.ptr<double>(i);
+        double* dstRow = dst.ptr<double>(r++);
+        for (int j = 0, c = 0; j < src.cols; j++)
+            if (!cols || cols[j])
+                dstRow[c++] = srcRow[j];
+    }
+}
+
+// Reduces the block-arrow normal system [A W; W^t V] to the Schur complement of the intrinsic
+// parameters selected by idx, S = A - sum(W_j*inv(V_j)*W_j^t), see HZ: (A6.14). V_j are the 6x6
+// extrinsic blocks, the block j starts at row j*6 and column j*blockColStep of blocks. Only the
+// upper triangles are read. The diagonals are damped by 1 + lambda, Y_j = W_j*inv(V_j) is stored
+// in the rows j*n of Y.
+static void reduceBlockArrowSystem(const double* intrinsicRows, size_t intrinsicStep, int nintrinsic,
+                                   const double* blocks, size_t blocksStep, int blockColStep, int nblocks,
+                                   const std::vector<int>& idx, double lambda, Mat_<double>& S,
+                                   std::vector<Matx66d>& Vinv, Mat_<double>& W, Mat_<double>& Y)
+{
+    const int blockSize = 6;
+    int n = (int)idx.size();
+
+    S.create(n, n); W.create(n, blockSize); Y.create(nblocks*n, blockSize);
+    for(int a = 0; a < n; a++) {
+        for(int b = a; b < n; b++)
+            S(a, b) = S(b, a) = intrinsicRows[idx[a]*intrinsicStep + idx[b]];
+        S(a, a) *= 1. + lambda;
+    }
+
+    Vinv.resize(nblocks);
+    for(int j = 0; j < nblocks; j++) {
+        int ofs = nintrinsic + j*blockSize;
+        const double* block = blocks + j*blockSize*blocksStep + j*blockColStep;
+        Matx66d V;
+        for(int a = 0; a < blockSize; a++) {
+            for(int b = a; b < blockSize; b++)
+                V(a, b) = V(b, a) = block[a*blocksStep + b];
+            V(a, a) *= 1. + lambda;
         }
+        bool isInverted = false;
+        Vinv[j] = V.inv(DECOMP_CHOLESKY, &isInverted);
+        if(!isInverted)
+            Vinv[j] = V.inv(DECOMP_SVD);
+
+        for(int a = 0; a < n; a++)
+            for(int k = 0; k < blockSize; k++)
+                W(a, k) = intrinsicRows[idx[a]*intrinsicStep + ofs + k];
+        for(int a = 0; a < n; a++)
+            for(int k = 0; k < blockSize; k++) {
+                double s = 0;
+                for(int l = 0; l < blockSize; l++)
+                    s += W(a, l)*Vinv[j](l, k);
+                Y(j*n + a, k) = s;
+            }
+        for(int a = 0; a < n; a++)
+            for(int b = a; b < n; b++) {
+                double s = 0;
+                for(int k = 0; k < blockSize; k++)
+                    s += Y(j*n + a, k)*W(b, k);
+                S(a, b) -= s;
+                if(a != b)
+                    S(b, a) -= s;
+            }
     }
+}
 
-    int nonzeros_rows  = cv::countNonZero(rows);
-    dst.create(nonzeros_rows, nonzeros_cols, CV_64FC1);
-    for (int i = 0, j = 0; i < (int)rows.size(); i++)
-    {
-        if (rows[i])
-        {
-            tmp.row(i).copyTo(dst.row(j++));
+// Standard deviations from the inverse of the normal matrix, see HZ: (A6.14). The extrinsic blocks
+// are eliminated with the Schur complement, so only the intrinsic part is inverted densely.
+static void computeStdDeviations(const Mat& intrinsicRows, const Mat& extrinsicBlocks, const uchar* mask,
+                                 double sigma2, bool withExtrinsics, Mat& stdDevs)
+{
+    const int blockSize = 6;
+    int nintrinsic = intrinsicRows.rows;
+    int nblocks = extrinsicBlocks.rows / blockSize;
+
+    std::vector<int> idx;
+    for(int i = 0; i < nintrinsic; i++)
+        if(mask[i])
+            idx.push_back(i);
+    int n = (int)idx.size();
+
+    Mat_<double> S, W, Y;
+    std::vector<Matx66d> Vinv;
+    reduceBlockArrowSystem(intrinsicRows.ptr<double>(), intrinsicRows.step / sizeof(double), nintrinsic,
+                           extrinsicBlocks.ptr<double>(), extrinsicBlocks.step / sizeof(double), 0, nblocks,
+                           idx, 0., S, Vinv, W, Y);
+
+    Mat_<double> Sinv;
+    if(n > 0) {
+#ifndef USE_LAPACK
+        cv::invert(S, Sinv, DECOMP_SVD);
+#else
+        cvfork::invert(S, Sinv, DECOMP_SVD);
+#endif
+    }
+
+    double* stdDevsData = stdDevs.ptr<double>();
+    std::fill(stdDevsData, stdDevsData + stdDevs.total(), 0.);
+    for(int a = 0; a < n; a++)
+        stdDevsData[idx[a]] = std::sqrt(Sinv(a, a)*sigma2);
+
+    if(!withExtrinsics)
+        return;
+
+    // diagonal of Vinv + Y^t*Sinv*Y for every view
+    for(int j = 0; j < nblocks; j++) {
+        int ofs = nintrinsic + j*blockSize;
+        for(int k = 0; k < blockSize; k++) {
+            double var = Vinv[j](k, k);
+            for(int a = 0; a < n; a++) {
+                double s = 0;
+                for(int b = 0; b < n; b++)
+                    s += Sinv(a, b)*Y(j*n + b, k);
+                var += Y(j*n + a, k)*s;
+            }
+            stdDevsData[ofs + k] = std::sqrt(var*sigma2);
         }
     }
 }
@@ -654,6 +1306,9 @@ void cvfork::CvLevMarqFork::step()
     double lambda = exp(lambdaLg10*LOG10);
     int nparams = param->rows;
 
+    if(schurIntrinsic > 0 && stepSchur())
+        return;
+
     Mat _JtJ = cvarrToMat(JtJ);
     Mat _mask = cvarrToMat(mask);
 
@@ -669,8 +1324,8 @@ void cvfork::CvLevMarqFork::step()
     Mat _JtErr = cvarrToMat(JtJV);
     Mat_<double> nonzero_param = cvarrToMat(JtJW);
 
-    subMatrix(cvarrToMat(JtErr), _JtErr, std::vector<uchar>(1, 1), _mask);
-    subMatrix(_JtJ, _JtJN, _mask, _mask);
+    subMatrix(cvarrToMat(JtErr), _JtErr, 0, mask->data.ptr);
+    subMatrix(_JtJ, _JtJN, mask->data.ptr, mask->data.ptr);
 
     if( !err )
         completeSymm( _JtJN, completeSymmFlag );
@@ -679,18 +1334,105 @@ void cvfork::CvLevMarqFork::step()
 #else
     _JtJN.diag() += lambda;
 #endif
-#ifndef USE_LAPACK
-    cv::solve(_JtJN, _JtErr, nonzero_param, solveMethod);
-#else
-    cvfork::solve(_JtJN, _JtErr, nonzero_param, solveMethod);
-#endif
+    solveSystem(_JtJN, _JtErr, nonzero_param);
 
     int j = 0;
     for( int i = 0; i < nparams; i++ )
         param->data.db[i] = prevParam->data.db[i] - (mask->data.ptr[i] ? nonzero_param(j++) : 0);
 }
 
-cvfork::CvLevMarqFork::CvLevMarqFork(int nparams, int nerrs, CvTermCriteria criteria0, bool _completeSymmFlag)
+void cvfork::CvLevMarqFork::solveSystem(const cv::Mat& A, const cv::Mat& b, cv::Mat& x) const
+{
+    using namespace cv;
+    // the damped system is positive-definite unless it is badly conditioned, then QR takes over
+    if(solveMethod == DECOMP_CHOLESKY && cvfork::solveCholesky(A, b, x))
+        return;
+    int method = solveMethod == DECOMP_CHOLESKY ? (int)DECOMP_QR : solveMethod;
+#ifndef USE_LAPACK
+    cv::solve(A, b, x, method);
+#else
+    cvfork::solve(A, b, x, method);
+#endif
+}
+
+bool cvfork::CvLevMarqFork::stepSchur()
+{
+    using namespace cv;
+    const int blockSize = 6;
+    const double LOG10 = log(10.);
+    double lambda = exp(lambdaLg10*LOG10);
+    int nparams = param->rows;
+    int nblocks = (nparams - schurIntrinsic) / blockSize;
+    const uchar* maskPtr = mask->data.ptr;
+
+    if(nblocks <= 0 || schurIntrinsic + nblocks*blockSize != nparams)
+        return false;
+    for(int i = schurIntrinsic; i < nparams; i++)
+        if(!maskPtr[i])
+            return false;
+
+    // upper triangle of JtJ is filled by the caller, see HZ: (A6.14)
+    const double* JtJData = JtJ->data.db;
+    const double* JtErrData = JtErr->data.db;
+    size_t JtJStep = JtJ->step / sizeof(double);
+
+    std::vector<int>& idx = schurIdx;
+    idx.clear();
+    for(int i = 0; i < schurIntrinsic; i++)
+        if(maskPtr[i])
+            idx.push_back(i);
+    int n = (int)idx.size();
+
+    Mat_<double> &S = schurS, &g = schurG, &dx = schurDx;
+    reduceBlockArrowSystem(JtJData, JtJStep, schurIntrinsic, JtJData + schurIntrinsic*(JtJStep + 1), JtJStep,
+                           blockSize, nblocks, idx, lambda, S, schurVinv, schurW, schurY);
+    const std::vector<Matx66d>& Vinv = schurVinv;
+    const Mat_<double>& Y = schurY;
+
+    g.create(n, 1); dx.create(n, 1);
+    for(int a = 0; a < n; a++) {
+        double s = JtErrData[idx[a]];
+        for(int j = 0; j < nblocks; j++) {
+            const double* e = JtErrData + schurIntrinsic + j*blockSize;
+            for(int k = 0; k < blockSize; k++)
+                s -= Y(j*n + a, k)*e[k];
+        }
+        g(a) = s;
+    }
+
+    if(n > 0)
+        solveSystem(S, g, dx);
+
+    double* p = param->data.db;
+    const double* pp = prevParam->data.db;
+    for(int i = 0; i < schurIntrinsic; i++)
+        p[i] = pp[i];
+    for(int a = 0; a < n; a++)
+        p[idx[a]] = pp[idx[a]] - dx(a);
+
+    for(int j = 0; j < nblocks; j++) {
+        int ofs = schurIntrinsic + j*blockSize;
+        Vec6d r;
+        for(int k = 0; k < blockSize; k++) {
+            double s = JtErrData[ofs + k];
+            for(int a = 0; a < n; a++)
+                s -= JtJData[idx[a]*JtJStep + ofs + k]*dx(a);
+            r[k] = s;
+        }
+        Vec6d dxj = Vinv[j]*r;
+        for(int k = 0; k < blockSize; k++)
+            p[ofs + k] = pp[ofs + k] - dxj[k];
+    }
+    return true;
+}
+
+void cvfork::CvLevMarqFork::enableSchurComplement(int nintrinsic)
+{
+    schurIntrinsic = nintrinsic;
+}
+
+cvfork::CvLevMarqFork::CvLevMarqFork(int nparams, int nerrs, CvTermCriteria criteria0, bool _completeSymmFlag) :
+    schurIntrinsic(0)
 {
     init(nparams, nerrs, criteria0, _completeSymmFlag);
 }
@@ -0,0 +1,267 @@
+#include "display.hpp"
+#include "calibCommon.hpp"
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cvconfig.h>
+#include <algorithm>
+#include <cstdint>
+
+using namespace calib;
+
+#define DISPLAY_MAX_FPS 60
+#define EVENTS_POLL_DELAY 1
+#define EVENTS_POLL_PERIOD 10
+
+#ifdef HAVE_QT
+static void postKeyButton(int state, void* data)
+{
+    state++;
+    Display::instance().postKey((int)(intptr_t)data);
+}
+
+static void postCheckboxKey(int state, void* data)
+{
+    Display::instance().postKey((int)(intptr_t)data | (state ? BUTTON_CHECKED_KEY : BUTTON_UNCHECKED_KEY));
+}
+#endif
+
+Display::Display()
+{
+    mIsRunning = mStop = false;
+}
+
+Display::~Display()
+{
+    stop();
+}
+
+Display& Display::instance()
+{
+    static Display display;
+    return display;
+}
+
+void Display::start()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mIsRunning)
+        return;
+    mStop = false;
+    mIsRunning = true;
+    mThread = std::thread(&Display::run, this);
+}
+
+void Display::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!mIsRunning)
+            return;
+        mStop = true;
+    }
+    mCondition.notify_all();
+    mThread.join();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIsRunning = false;
+    mWindows.clear();
+    mCommands.clear();
+    mKeys.clear();
+}
+
+bool Display::isRunning()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mIsRunning;
+}
+
+void Display::pushCommand(const Display::windowCommand &command)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!mIsRunning)
+            return;
+        mCommands.push_back(command);
+    }
+    mCondition.notify_all();
+}
+
+Display::windowFrame& Display::getWindow(const std::string &name)
+{
+    for(auto& window : mWindows)
+        if(window.name == name)
+            return window;
+    mWindows.push_back(windowFrame());
+    mWindows.back().name = name;
+    return mWindows.back();
+}
+
+bool Display::hasNewFrames() const
+{
+    for(const auto& window : mWindows)
+        if(window.isNew)
+            return true;
+    return false;
+}
+
+void Display::createWindow(const std::string &name, cv::Point position)
+{
+    windowCommand command;
+    command.type = commandType::NewWindow;
+    command.name = name;
+    command.position = position;
+    pushCommand(command);
+}
+
+void Display::destroyWindow(const std::string &name)
+{
+    windowCommand command;
+    command.type = commandType::RemoveWindow;
+    command.name = name;
+    pushCommand(command);
+}
+
+void Display::createButton(const std::string &name, int key, int buttonType, bool initialState)
+{
+    windowCommand command;
+    command.type = commandType::NewButton;
+    command.name = name;
+    command.key = key;
+    command.buttonType = buttonType;
+    command.buttonState = initialState;
+    pushCommand(command);
+}
+
+void Display::showOverlay(const std::string &name, const std::string &text, int delay)
+{
+    windowCommand command;
+    command.type = commandType::Overlay;
+    command.name = name;
+    command.text = text;
+    command.delay = delay;
+    pushCommand(command);
+}
+
+void Display::show(const std::string &name, const cv::Mat &frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!mIsRunning)
+            return;
+        windowFrame& window = getWindow(name);
+        window.frame = frame;
+        window.isNew = true;
+    }
+    mCondition.notify_all();
+}
+
+void Display::showMessage(const std::string &name, const std::string &message, int duration)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(!mIsRunning)
+        return;
+    windowFrame& window = getWindow(name);
+    window.message = message;
+    window.messageUntil = clock::now() + std::chrono::milliseconds(duration);
+}
+
+static void drawMessage(const cv::Mat& frame, const std::string& message, cv::Mat& composed)
+{
+    // the frame still belongs to its sender, so the message is drawn over an inverted copy
+    cv::bitwise_not(frame, composed);
+    double textSize = OVERLAY_TEXT_SIZE * frame.cols / (double) IMAGE_MAX_WIDTH;
+    cv::putText(composed, message, cv::Point(100, 100), 1, textSize, cv::Scalar(0,0,255), 2, cv::LINE_AA);
+}
+
+void Display::postKey(int key)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mKeys.push_back(key);
+}
+
+int Display::pollKey()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mKeys.empty())
+        return -1;
+    int key = mKeys.front();
+    mKeys.pop_front();
+    return key;
+}
+
+void Display::run()
+{
+    const clock::duration presentPeriod = std::chrono::microseconds(1000000 / DISPLAY_MAX_FPS);
+    clock::time_point nextPresent = clock::now();
+    std::deque<windowCommand> commands;
+    std::vector<windowFrame> frames;
+    cv::Mat composed;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(!mStop) {
+        commands.swap(mCommands);
+        clock::time_point now = clock::now();
+        if(now >= nextPresent)
+            for(auto& window : mWindows)
+                if(window.isNew) {
+                    frames.push_back(window);
+                    if(now >= window.messageUntil)
+                        frames.back().message.clear();
+                    window.frame.release();
+                    window.isNew = false;
+                }
+        lock.unlock();
+
+        for(const windowCommand& command : commands) {
+            if(command.type == commandType::NewWindow) {
+                cv::namedWindow(command.name);
+                cv::moveWindow(command.name, command.position.x, command.position.y);
+            }
+            else if(command.type == commandType::RemoveWindow)
+                cv::destroyWindow(command.name);
+#ifdef HAVE_QT
+            else if(command.type == commandType::NewButton)
+                cv::createButton(command.name, command.buttonType == cv::QT_CHECKBOX ? postCheckboxKey : postKeyButton,
+                                 (void*)(intptr_t)command.key,
+                                 command.buttonType, command.buttonState);
+            else if(command.type == commandType::Overlay)
+                cv::displayOverlay(command.name, command.text, command.delay);
+#endif
+        }
+        commands.clear();
+
+        for(const windowFrame& window : frames) {
+            if(window.frame.empty())
+                continue;
+            if(window.message.empty())
+                cv::imshow(window.name, window.frame);
+            else {
+                drawMessage(window.frame, window.message, composed);
+                cv::imshow(window.name, composed);
+            }
+        }
+        if(!frames.empty())
+            nextPresent = clock::now() + presentPeriod;
+        frames.clear();
+
+        // waitKey also runs the GUI events, so it is called even when nothing was presented
+        int key = cv::waitKey(EVENTS_POLL_DELAY);
+
+        lock.lock();
+        if(key >= 0)
+            mKeys.push_back(key);
+
+        // a new frame is presented as soon as the present period allows, otherwise the events
+        // are polled every EVENTS_POLL_PERIOD milliseconds
+        now = clock::now();
+        clock::time_point deadline = now + std::chrono::milliseconds(EVENTS_POLL_PERIOD);
+        if(nextPresent > now)
+            deadline = std::min(deadline, nextPresent);
+        mCondition.wait_until(lock, deadline, [&] {
+            return mStop || !mCommands.empty() || (hasNewFrames() && clock::now() >= nextPresent);
+        });
+    }
+    lock.unlock();
+    cv::destroyAllWindows();
+}
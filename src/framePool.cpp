@@ -0,0 +1,36 @@
+#include "framePool.hpp"
+#include <algorithm>
+
+using namespace calib;
+
+FramePool::FramePool(size_t maxBuffersNum) :
+    mMaxBuffersNum(std::max(maxBuffersNum, (size_t)1))
+{
+}
+
+cv::Mat FramePool::acquire(cv::Size size, int type)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for(const cv::Mat& buffer : mBuffers)
+        if(buffer.size() == size && buffer.type() == type && !isShared(buffer))
+            return buffer;
+
+    cv::Mat buffer(size, type);
+    auto freeSlot = std::find_if(mBuffers.begin(), mBuffers.end(), [](const cv::Mat& m) { return !isShared(m); });
+    if(freeSlot != mBuffers.end())
+        *freeSlot = buffer;
+    else if(mBuffers.size() < mMaxBuffersNum)
+        mBuffers.push_back(buffer);
+    return buffer;
+}
+
+void FramePool::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBuffers.clear();
+}
+
+bool FramePool::isShared(const cv::Mat &frame)
+{
+    return frame.u && CV_XADD(&frame.u->refcount, 0) > 1;
+}
@@ -1,19 +1,76 @@
 #include "frameProcessor.hpp"
+#include "display.hpp"
 #include "rotationConverters.hpp"
+#include "profiler.hpp"
 
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/features2d.hpp>
 #include <opencv2/aruco/charuco.hpp>
-#include <opencv2/highgui.hpp>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <limits>
+#include <cfloat>
 
 using namespace calib;
 
-#define VIDEO_TEXT_SIZE 4
 #define POINT_SIZE 5
+#define HEAT_MAP_ALPHA 0.4
+#define TRACKING_COARSE_WIDTH 640
+#define TRACKING_FULL_SEARCH_PERIOD 5
+#define PREVIEW_BUFFERS_NUM 8
+#define PRECHECK_WIDTH 160
+#define PRECHECK_FAST_THRESHOLD 20
+#define PRECHECK_MIN_FEATURES 8
+#define POSE_GUESS_MAX_RMS 2.0
+#define POSE_REFINE_MAX_START_RMS 40.0
+#define POSE_REFINE_ITERATIONS 5
+#define POSE_REFINE_EPS 1e-3
+#define CAPTURE_MESSAGE_TIME 300
+
+// A few Gauss-Newton steps of the pose from its current value, see HZ: (A6.2). Returns the
+// reprojection RMS of the best pose; a start too far from the points is not refined at all
+static double refinePose(const std::vector<cv::Point3f>& objectPoints, const cv::Mat& imagePoints,
+                         const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, cv::Mat& rvec, cv::Mat& tvec,
+                         std::vector<cv::Point2f>& projections, cv::Mat& jacobian)
+{
+    int n = (int)objectPoints.size();
+    cv::Mat target = imagePoints.reshape(2, n);
+    cv::Mat pose(6, 1, CV_64F), step, errors, JtJ, JtErr;
+    rvec.reshape(1, 3).convertTo(pose.rowRange(0, 3), CV_64F);
+    tvec.reshape(1, 3).convertTo(pose.rowRange(3, 6), CV_64F);
+
+    double bestRms = DBL_MAX;
+    cv::Mat bestPose = pose.clone();
+    for(int iter = 0; iter <= POSE_REFINE_ITERATIONS; iter++) {
+        cv::projectPoints(objectPoints, pose.rowRange(0, 3), pose.rowRange(3, 6), cameraMatrix, distCoeffs,
+                          projections, jacobian);
+        cv::subtract(cv::Mat(projections).reshape(2, n), target, errors, cv::noArray(), CV_64F);
+        errors = errors.reshape(1, 2*n);
+        double rms = std::sqrt(errors.dot(errors) / n);
+
+        if(rms >= bestRms || (iter == 0 && rms > POSE_REFINE_MAX_START_RMS))
+            break;
+        bool isConverged = bestRms - rms < POSE_REFINE_EPS*rms;
+        bestRms = rms;
+        pose.copyTo(bestPose);
+        if(isConverged || iter == POSE_REFINE_ITERATIONS)
+            break;
+
+        // the first 6 columns are the derivatives by the rotation and the translation
+        cv::Mat J = jacobian.colRange(0, 6);
+        cv::mulTransposed(J, JtJ, true);
+        cv::gemm(J, errors, 1, cv::noArray(), 0, JtErr, cv::GEMM_1_T);
+        if(!cv::solve(JtJ, JtErr, step, cv::DECOMP_CHOLESKY))
+            break;
+        pose -= step;
+    }
+
+    bestPose.rowRange(0, 3).copyTo(rvec);
+    bestPose.rowRange(3, 6).copyTo(tvec);
+    return bestRms;
+}
 
 static cv::SimpleBlobDetector::Params getDetectorParams()
 {
@@ -25,8 +82,8 @@ static cv::SimpleBlobDetector::Params getDetectorParams()
     detectorParams.minRepeatability = 2;
     detectorParams.minDistBetweenBlobs = 5;
 
-    detectorParams.filterByColor = true;
-    detectorParams.blobColor = 0;
+    // dark and light blobs are found in one thresholding sweep and split afterwards
+    detectorParams.filterByColor = false;
 
     detectorParams.filterByArea = true;
     detectorParams.minArea = 5;
@@ -48,52 +105,141 @@ static cv::SimpleBlobDetector::Params getDetectorParams()
     return detectorParams;
 }
 
+namespace
+{
+// feeds findCirclesGrid with blobs that are already detected
+class PresetKeypointsDetector : public cv::Feature2D
+{
+    std::vector<cv::KeyPoint> keypoints;
+public:
+    PresetKeypointsDetector(const std::vector<cv::KeyPoint>& _keypoints) : keypoints(_keypoints) {}
+
+    void detect(cv::InputArray, std::vector<cv::KeyPoint>& _keypoints, cv::InputArray = cv::noArray()) override
+    {
+        _keypoints = keypoints;
+    }
+};
+}
+
+// blobs are darker or lighter than the samples taken just outside of them
+static void splitBlobsByColor(const cv::Mat& gray, const std::vector<cv::KeyPoint>& blobs,
+                              std::vector<cv::KeyPoint>& darkBlobs, std::vector<cv::KeyPoint>& lightBlobs)
+{
+    const int samplesNum = 8;
+    darkBlobs.clear();
+    lightBlobs.clear();
+    for(const cv::KeyPoint& blob : blobs) {
+        cv::Point center(cvRound(blob.pt.x), cvRound(blob.pt.y));
+        if(center.x < 0 || center.y < 0 || center.x >= gray.cols || center.y >= gray.rows)
+            continue;
+        double surrounding = 0;
+        for(int i = 0; i < samplesNum; i++) {
+            double angle = 2*CV_PI*i / samplesNum;
+            int x = std::min(std::max(cvRound(blob.pt.x + blob.size*std::cos(angle)), 0), gray.cols - 1);
+            int y = std::min(std::max(cvRound(blob.pt.y + blob.size*std::sin(angle)), 0), gray.rows - 1);
+            surrounding += gray.at<uchar>(y, x);
+        }
+        if(gray.at<uchar>(center) < surrounding / samplesNum)
+            darkBlobs.push_back(blob);
+        else
+            lightBlobs.push_back(blob);
+    }
+}
+
 FrameProcessor::~FrameProcessor()
 {
 
 }
 
-bool CalibProcessor::detectAndParseChessboard(const cv::Mat &frame)
+bool FrameProcessor::isStateless() const
 {
+    return false;
+}
+
+void CalibProcessor::prepareFrame(const cv::Mat &frame)
+{
+    ScopedTimer timer(ProfileStage::Grayscale);
+    if(frame.channels() == 1)
+        mGrayFrame = frame;
+    else {
+        cv::cvtColor(frame, mGrayBuffer, cv::COLOR_BGR2GRAY);
+        mGrayFrame = mGrayBuffer;
+    }
+    mPyramidLevelsNum = 1;
+}
+
+cv::Mat CalibProcessor::getPyramidLevel(int level)
+{
+    // levels are built on demand and keep their buffers between frames
+    if((int)mGrayPyramid.size() < level)
+        mGrayPyramid.resize(level);
+    for(; mPyramidLevelsNum <= level; mPyramidLevelsNum++) {
+        const cv::Mat& src = mPyramidLevelsNum == 1 ? mGrayFrame : mGrayPyramid[mPyramidLevelsNum - 2];
+        cv::pyrDown(src, mGrayPyramid[mPyramidLevelsNum - 1]);
+    }
+    return level == 0 ? mGrayFrame : mGrayPyramid[level - 1];
+}
+
+bool CalibProcessor::passesPrecheck()
+{
+    if(!mBoardPrecheck && !mMotionGate)
+        return true;
+
+    ScopedTimer timer(ProfileStage::Precheck);
+    int level = 0;
+    while(getPyramidLevel(level).cols > PRECHECK_WIDTH)
+        level++;
+    cv::Mat tinyFrame = getPyramidLevel(level);
+
+    bool isPassed = true;
+    if(mMotionGate) {
+        tinyFrame.convertTo(mMotionFrame, CV_32F);
+        if(mLastMotionFrame.size() == mMotionFrame.size()) {
+            if(mMotionWindow.size() != mMotionFrame.size())
+                cv::createHanningWindow(mMotionWindow, mMotionFrame.size(), CV_32F);
+            cv::Point2d shift = cv::phaseCorrelate(mLastMotionFrame, mMotionFrame, mMotionWindow);
+            // the capture stability test allows mMaxTemplateOffset over the whole delay
+            double maxShift = mMaxTemplateOffset / std::max(mDelayBetweenCaptures, 1u);
+            isPassed = cv::norm(shift)*(1 << level) <= maxShift;
+        }
+        std::swap(mMotionFrame, mLastMotionFrame);
+    }
+    if(isPassed && mBoardPrecheck) {
+        cv::FAST(tinyFrame, mPrecheckKeypoints, PRECHECK_FAST_THRESHOLD, true);
+        isPassed = mPrecheckKeypoints.size() >= PRECHECK_MIN_FEATURES;
+    }
+    return isPassed;
+}
+
+bool CalibProcessor::detectAndParseChessboard(const cv::Mat &frame, const cv::Mat &gray)
+{
+    ScopedTimer timer(ProfileStage::DetectChessboard);
     int chessBoardFlags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK;
-    bool isTemplateFound = cv::findChessboardCorners(frame, mBoardSize, mCurrentImagePoints, chessBoardFlags);
+    bool isTemplateFound = cv::findChessboardCorners(gray, mBoardSize, mCurrentImagePoints, chessBoardFlags);
 
     if (isTemplateFound) {
-        cv::Mat viewGray;
-        cv::cvtColor(frame, viewGray, cv::COLOR_BGR2GRAY);
-        cv::cornerSubPix(viewGray, mCurrentImagePoints, cv::Size(11,11),
-            cv::Size(-1,-1), cv::TermCriteria( cv::TermCriteria::EPS+cv::TermCriteria::COUNT, 30, 0.1 ));
-        cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(mCurrentImagePoints), isTemplateFound);
-        mTemplateLocations.insert(mTemplateLocations.begin(), mCurrentImagePoints[0]);
+        {
+            ScopedTimer subPixTimer(ProfileStage::CornerSubPix);
+            cv::cornerSubPix(gray, mCurrentImagePoints, cv::Size(11,11),
+                cv::Size(-1,-1), cv::TermCriteria( cv::TermCriteria::EPS+cv::TermCriteria::COUNT, 30, 0.1 ));
+        }
+        if(!frame.empty())
+            cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(mCurrentImagePoints), isTemplateFound);
     }
     return isTemplateFound;
 }
 
-bool CalibProcessor::detectAndParseChAruco(const cv::Mat &frame)
+bool CalibProcessor::detectAndParseChAruco(const cv::Mat &frame, const cv::Mat &gray)
 {
-    cv::Ptr<cv::aruco::Board> board = mCharucoBoard.staticCast<cv::aruco::Board>();
-
-    std::vector<std::vector<cv::Point2f>> corners, rejected;
-    std::vector<int> ids;
-    cv::aruco::detectMarkers(frame, mArucoDictionary, corners, ids, cv::aruco::DetectorParameters::create(), rejected);
-    cv::aruco::refineDetectedMarkers(frame, board, corners, ids, rejected);
+    ScopedTimer timer(ProfileStage::DetectChAruco);
     cv::Mat currentCharucoCorners, currentCharucoIds;
-    if(ids.size() > 0)
-        cv::aruco::interpolateCornersCharuco(corners, ids, frame, mCharucoBoard, currentCharucoCorners,
-                                         currentCharucoIds);
-    if(ids.size() > 0) cv::aruco::drawDetectedMarkers(frame, corners);
+    mCharucoDetector->detect(gray, currentCharucoCorners, currentCharucoIds);
+    if(!frame.empty())
+        mCharucoDetector->drawMarkers(frame);
 
     if(currentCharucoCorners.total() > 3) {
-        float centerX = 0, centerY = 0;
-        for (int i = 0; i < currentCharucoCorners.size[0]; i++) {
-            centerX += currentCharucoCorners.at<float>(i, 0);
-            centerY += currentCharucoCorners.at<float>(i, 1);
-        }
-        centerX /= currentCharucoCorners.size[0];
-        centerY /= currentCharucoCorners.size[0];
-        //cv::circle(frame, cv::Point2f(centerX, centerY), 10, cv::Scalar(0, 255, 0), 10);
-        mTemplateLocations.insert(mTemplateLocations.begin(), cv::Point2f(centerX, centerY));
-        cv::aruco::drawDetectedCornersCharuco(frame, currentCharucoCorners, currentCharucoIds);
+        if(!frame.empty())
+            cv::aruco::drawDetectedCornersCharuco(frame, currentCharucoCorners, currentCharucoIds);
         mCurrentCharucoCorners = currentCharucoCorners;
         mCurrentCharucoIds = currentCharucoIds;
         return true;
@@ -102,41 +248,126 @@ bool CalibProcessor::detectAndParseChAruco(const cv::Mat &frame)
     return false;
 }
 
-bool CalibProcessor::detectAndParseACircles(const cv::Mat &frame)
+bool CalibProcessor::detectAndParseACircles(const cv::Mat &frame, const cv::Mat &gray)
 {
-    bool isTemplateFound = findCirclesGrid(frame, mBoardSize, mCurrentImagePoints, cv::CALIB_CB_ASYMMETRIC_GRID, mBlobDetectorPtr);
-    if(isTemplateFound) {
-        mTemplateLocations.insert(mTemplateLocations.begin(), mCurrentImagePoints[0]);
+    ScopedTimer timer(ProfileStage::DetectACircles);
+    bool isTemplateFound = findCirclesGrid(gray, mBoardSize, mCurrentImagePoints, cv::CALIB_CB_ASYMMETRIC_GRID, mBlobDetectorPtr);
+    if(isTemplateFound && !frame.empty())
         cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(mCurrentImagePoints), isTemplateFound);
-    }
     return isTemplateFound;
 }
 
-bool CalibProcessor::detectAndParseDualACircles(const cv::Mat &frame)
+bool CalibProcessor::detectAndParseDualACircles(const cv::Mat &frame, const cv::Mat &gray)
 {
+    ScopedTimer timer(ProfileStage::DetectDualACircles);
     std::vector<cv::Point2f> blackPointbuf;
 
-    cv::Mat invertedView;
-    cv::bitwise_not(frame, invertedView);
-    bool isWhiteGridFound = cv::findCirclesGrid(frame, mBoardSize, mCurrentImagePoints, cv::CALIB_CB_ASYMMETRIC_GRID, mBlobDetectorPtr);
+    std::vector<cv::KeyPoint> blobs, darkBlobs, lightBlobs;
+    mBlobDetectorPtr->detect(gray, blobs);
+    splitBlobsByColor(gray, blobs, darkBlobs, lightBlobs);
+
+    bool isWhiteGridFound = cv::findCirclesGrid(gray, mBoardSize, mCurrentImagePoints, cv::CALIB_CB_ASYMMETRIC_GRID,
+                                                cv::makePtr<PresetKeypointsDetector>(darkBlobs));
     if(!isWhiteGridFound)
         return false;
-    bool isBlackGridFound = cv::findCirclesGrid(invertedView, mBoardSize, blackPointbuf, cv::CALIB_CB_ASYMMETRIC_GRID, mBlobDetectorPtr);
+    bool isBlackGridFound = cv::findCirclesGrid(gray, mBoardSize, blackPointbuf, cv::CALIB_CB_ASYMMETRIC_GRID,
+                                                cv::makePtr<PresetKeypointsDetector>(lightBlobs));
 
     if(!isBlackGridFound)
     {
         mCurrentImagePoints.clear();
         return false;
     }
-    cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(mCurrentImagePoints), isWhiteGridFound);
-    cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(blackPointbuf), isBlackGridFound);
+    if(!frame.empty()) {
+        cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(mCurrentImagePoints), isWhiteGridFound);
+        cv::drawChessboardCorners(frame, mBoardSize, cv::Mat(blackPointbuf), isBlackGridFound);
+    }
     mCurrentImagePoints.insert(mCurrentImagePoints.end(), blackPointbuf.begin(), blackPointbuf.end());
-    mTemplateLocations.insert(mTemplateLocations.begin(), mCurrentImagePoints[0]);
 
     return true;
 }
 
-void CalibProcessor::saveFrameData()
+bool CalibProcessor::detectAndParseTemplate(const cv::Mat &frame, const cv::Mat &gray)
+{
+    switch(mBoardType)
+    {
+    case TemplateType::Chessboard:
+        return detectAndParseChessboard(frame, gray);
+    case TemplateType::chAruco:
+        return detectAndParseChAruco(frame, gray);
+    case TemplateType::AcirclesGrid:
+        return detectAndParseACircles(frame, gray);
+    case TemplateType::DoubleAcirclesGrid:
+        return detectAndParseDualACircles(frame, gray);
+    }
+    return false;
+}
+
+bool CalibProcessor::detectInRegion(const cv::Mat &frame, const cv::Rect &region)
+{
+    if(!detectAndParseTemplate(frame(region), mGrayFrame(region)))
+        return false;
+
+    cv::Point2f offset((float)region.x, (float)region.y);
+    for(auto it = mCurrentImagePoints.begin(); it != mCurrentImagePoints.end(); ++it)
+        *it += offset;
+    if(mBoardType == TemplateType::chAruco)
+        for(int i = 0; i < (int)mCurrentCharucoCorners.total(); i++)
+            mCurrentCharucoCorners.at<cv::Point2f>(i) += offset;
+    return true;
+}
+
+cv::Rect CalibProcessor::getCurrentTemplateRegion(double scale, double margin) const
+{
+    cv::Rect bounds = mBoardType == TemplateType::chAruco ? cv::boundingRect(mCurrentCharucoCorners) :
+                                                            cv::boundingRect(mCurrentImagePoints);
+    // the bounds are measured on the scaled level, the template offset is in full resolution pixels
+    int dx = cvRound(bounds.width*margin*scale + mMaxTemplateOffset);
+    int dy = cvRound(bounds.height*margin*scale + mMaxTemplateOffset);
+    return cv::Rect(cvFloor(bounds.x*scale) - dx, cvFloor(bounds.y*scale) - dy,
+                    cvCeil(bounds.width*scale) + 2*dx, cvCeil(bounds.height*scale) + 2*dy);
+}
+
+cv::Point2f CalibProcessor::getCurrentTemplateLocation() const
+{
+    if(mBoardType != TemplateType::chAruco)
+        return mCurrentImagePoints[0];
+
+    cv::Scalar center = cv::mean(mCurrentCharucoCorners);
+    return cv::Point2f((float)center[0], (float)center[1]);
+}
+
+bool CalibProcessor::detectWithTracking(const cv::Mat &frame)
+{
+    const double trackingMargin = 0.25;
+    cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+    cv::Rect region = mTrackedRegion & frameRect;
+    bool hasCoarseLevel = frame.cols > TRACKING_COARSE_WIDTH;
+
+    // board was lost: look for it on a pyramid level first
+    if(region.area() == 0 && hasCoarseLevel) {
+        int level = 0;
+        while(getPyramidLevel(level).cols > TRACKING_COARSE_WIDTH)
+            level++;
+        if(detectAndParseTemplate(cv::Mat(), getPyramidLevel(level)))
+            region = getCurrentTemplateRegion((double)(1 << level), trackingMargin) & frameRect;
+    }
+
+    bool isTemplateFound = false;
+    if(region.area() > 0 && region.area() < frameRect.area())
+        isTemplateFound = detectInRegion(frame, region);
+    if(!isTemplateFound && (!hasCoarseLevel || region.area() > 0 ||
+                            ++mFramesSinceFullSearch >= TRACKING_FULL_SEARCH_PERIOD)) {
+        mFramesSinceFullSearch = 0;
+        mCurrentImagePoints.clear();
+        isTemplateFound = detectAndParseTemplate(frame, mGrayFrame);
+    }
+
+    mTrackedRegion = isTemplateFound ? getCurrentTemplateRegion(1., trackingMargin) : cv::Rect();
+    return isTemplateFound;
+}
+
+std::vector<cv::Point3f> CalibProcessor::createBoardPoints() const
 {
     std::vector<cv::Point3f> objectPoints;
 
@@ -147,20 +378,15 @@ void CalibProcessor::saveFrameData()
         for( int i = 0; i < mBoardSize.height; ++i )
             for( int j = 0; j < mBoardSize.width; ++j )
                 objectPoints.push_back(cv::Point3f(j*mSquareSize, i*mSquareSize, 0));
-        mCalibData->imagePoints.push_back(mCurrentImagePoints);
-        mCalibData->objectPoints.push_back(objectPoints);
         break;
     case TemplateType::chAruco:
-        mCalibData->allCharucoCorners.push_back(mCurrentCharucoCorners);
-        mCalibData->allCharucoIds.push_back(mCurrentCharucoIds);
+        objectPoints = mCharucoBoard->chessboardCorners;
         break;
     case TemplateType::AcirclesGrid:
         objectPoints.reserve(mBoardSize.height*mBoardSize.width);
         for( int i = 0; i < mBoardSize.height; i++ )
             for( int j = 0; j < mBoardSize.width; j++ )
                 objectPoints.push_back(cv::Point3f((2*j + i % 2)*mSquareSize, i*mSquareSize, 0));
-        mCalibData->imagePoints.push_back(mCurrentImagePoints);
-        mCalibData->objectPoints.push_back(objectPoints);
         break;
     case TemplateType::DoubleAcirclesGrid:
     {
@@ -181,22 +407,27 @@ void CalibProcessor::saveFrameData()
             for( int j = 0; j < mBoardSize.width; j++ )
                 objectPoints.push_back(cv::Point3f(-float((2*j + i % 2)*mSquareSize - gridCenterX),
                                           -float(i*mSquareSize) - gridCenterY, 0));
-
-        mCalibData->imagePoints.push_back(mCurrentImagePoints);
-        mCalibData->objectPoints.push_back(objectPoints);
     }
         break;
     }
+
+    return objectPoints;
+}
+
+void CalibProcessor::saveFrameData()
+{
+    size_t viewIndex = mCalibData->points.getViewsNumber();
+    if(mBoardType == TemplateType::chAruco)
+        mCalibData->points.addView(mCurrentCharucoCorners, mCurrentCharucoIds);
+    else
+        mCalibData->points.addView(mCurrentImagePoints);
+    mCalibData->coverage.addView(mCalibData->points.getImagePoints(viewIndex),
+                                 mCalibData->points.getPointsNumber(viewIndex));
 }
 
-void CalibProcessor::showCaptureMessage(const cv::Mat& frame, const std::string &message)
+void CalibProcessor::showCaptureMessage(const std::string &message)
 {
-    cv::Point textOrigin(100, 100);
-    double textSize = VIDEO_TEXT_SIZE * frame.cols / (double) IMAGE_MAX_WIDTH;
-    cv::bitwise_not(frame, frame);
-    cv::putText(frame, message, textOrigin, 1, textSize, cv::Scalar(0,0,255), 2, cv::LINE_AA);
-    cv::imshow(mainWindowName, frame);
-    cv::waitKey(300);
+    Display::instance().showMessage(mainWindowName, message, CAPTURE_MESSAGE_TIME);
 }
 
 bool CalibProcessor::checkLastFrame()
@@ -215,37 +446,54 @@ bool CalibProcessor::checkLastFrame()
     else
         mCalibData->cameraMatrix.copyTo(tmpCamMatrix);
 
-    if(mBoardType != TemplateType::chAruco) {
-        cv::Mat r, t, angles;
-        cv::solvePnP(mCalibData->objectPoints.back(), mCurrentImagePoints, tmpCamMatrix, mCalibData->distCoeffs, r, t);
-        RodriguesToEuler(r, angles, CALIB_DEGREES);
-
-        if(fabs(angles.at<double>(0)) > badAngleThresh || fabs(angles.at<double>(1)) > badAngleThresh) {
-            mCalibData->objectPoints.pop_back();
-            mCalibData->imagePoints.pop_back();
-            isFrameBad = true;
-        }
+    bool isCalibrated = mCalibData->cameraMatrix.total() != 0;
+    cv::Mat r, t, angles;
+    {
+        ScopedTimer timer(ProfileStage::PoseCheck);
+        estimateLastViewPose(tmpCamMatrix, isCalibrated, r, t);
     }
-    else {
-        cv::Mat r, t, angles;
-        std::vector<cv::Point3f> allObjPoints;
-        allObjPoints.reserve(mCurrentCharucoIds.total());
-        for(size_t i = 0; i < mCurrentCharucoIds.total(); i++) {
-            int pointID = mCurrentCharucoIds.at<int>(i);
-            CV_Assert(pointID >= 0 && pointID < (int)mCharucoBoard->chessboardCorners.size());
-            allObjPoints.push_back(mCharucoBoard->chessboardCorners[pointID]);
-        }
-
-        cv::solvePnP(allObjPoints, mCurrentCharucoCorners, tmpCamMatrix, mCalibData->distCoeffs, r, t);
-        RodriguesToEuler(r, angles, CALIB_DEGREES);
+    RodriguesToEuler(r, angles, CALIB_DEGREES);
+
+    double xAngle = fabs(angles.at<double>(0));
+    if(mBoardType == TemplateType::chAruco)
+        xAngle = 180.0 - xAngle;
+    if(xAngle > badAngleThresh || fabs(angles.at<double>(1)) > badAngleThresh) {
+        mCalibData->points.removeLastView();
+        mCalibData->coverage.removeLastView();
+        isFrameBad = true;
+    }
+    else if(isCalibrated && mCalibData->rvecs.size() == mCalibData->points.getViewsNumber() - 1) {
+        // initial extrinsics of the new view for a warm started solve
+        mCalibData->rvecs.push_back(r.clone());
+        mCalibData->tvecs.push_back(t.clone());
+    }
+    return isFrameBad;
+}
 
-        if(180.0 - fabs(angles.at<double>(0)) > badAngleThresh || fabs(angles.at<double>(1)) > badAngleThresh) {
-            isFrameBad = true;
-            mCalibData->allCharucoCorners.pop_back();
-            mCalibData->allCharucoIds.pop_back();
+void CalibProcessor::estimateLastViewPose(const cv::Mat &cameraMatrix, bool isCalibrated, cv::Mat &rvec, cv::Mat &tvec)
+{
+    size_t lastView = mCalibData->points.getViewsNumber() - 1;
+    mCalibData->points.getObjectPoints(lastView, mPoseObjectPoints);
+    cv::Mat imagePoints = mCalibData->points.getImagePointsMat(lastView);
+
+    // the guess is refined by a few steps and kept only while it explains the points, a board
+    // moved too far between the captures is solved from scratch
+    if(isCalibrated && !mLastRvec.empty()) {
+        double rms = refinePose(mPoseObjectPoints, imagePoints, cameraMatrix, mCalibData->distCoeffs,
+                                mLastRvec, mLastTvec, mPoseProjections, mPoseJacobian);
+        if(rms < POSE_GUESS_MAX_RMS) {
+            rvec = mLastRvec;
+            tvec = mLastTvec;
+            return;
         }
     }
-    return isFrameBad;
+
+    cv::solvePnP(mPoseObjectPoints, imagePoints, cameraMatrix, mCalibData->distCoeffs, mLastRvec, mLastTvec);
+    rvec = mLastRvec;
+    tvec = mLastTvec;
+    // poses found with the guessed camera matrix are no guess for the calibrated camera
+    if(!isCalibrated)
+        mLastRvec.release();
 }
 
 CalibProcessor::CalibProcessor(Sptr<calibrationData> data, captureParameters &capParams) :
@@ -258,6 +506,11 @@ CalibProcessor::CalibProcessor(Sptr<calibrationData> data, captureParameters &ca
                                    std::pow(mCalibData->imageSize.width, 2)) / 20.0;
     mSquareSize = capParams.squareSize;
     mTemplDist = capParams.templDst;
+    mBoardTracking = capParams.boardTracking;
+    mBoardPrecheck = capParams.boardPrecheck;
+    mMotionGate = capParams.motionGate;
+    mFramesSinceFullSearch = 0;
+    mPyramidLevelsNum = 0;
 
     switch(mBoardType)
     {
@@ -266,6 +519,7 @@ CalibProcessor::CalibProcessor(Sptr<calibrationData> data, captureParameters &ca
                     cv::aruco::PREDEFINED_DICTIONARY_NAME(capParams.charucoDictName));
         mCharucoBoard = cv::aruco::CharucoBoard::create(mBoardSize.width, mBoardSize.height, capParams.charucoSquareLenght,
                                                         capParams.charucoMarkerSize, mArucoDictionary);
+        mCharucoDetector = std::make_shared<CharucoDetector>(mCharucoBoard, mArucoDictionary);
         break;
     case TemplateType::AcirclesGrid:
         mBlobDetectorPtr = cv::SimpleBlobDetector::create();
@@ -276,55 +530,87 @@ CalibProcessor::CalibProcessor(Sptr<calibrationData> data, captureParameters &ca
     case TemplateType::Chessboard:
         break;
     }
+    mCalibData->points.setBoardModel(std::make_shared<const BoardModel>(createBoardPoints()));
 }
 
 cv::Mat CalibProcessor::processFrame(const cv::Mat &frame)
 {
-    cv::Mat frameCopy;
-    frame.copyTo(frameCopy);
-    bool isTemplateFound = false;
     mCurrentImagePoints.clear();
 
-    switch(mBoardType)
-    {
-    case TemplateType::Chessboard:
-        isTemplateFound = detectAndParseChessboard(frameCopy);
-        break;
-    case TemplateType::chAruco:
-        isTemplateFound = detectAndParseChAruco(frameCopy);
-        break;
-    case TemplateType::AcirclesGrid:
-        isTemplateFound = detectAndParseACircles(frameCopy);
-        break;
-    case TemplateType::DoubleAcirclesGrid:
-        isTemplateFound = detectAndParseDualACircles(frameCopy);
-        break;
-    }
+    // the frame belongs to the pipeline stage, detections are drawn straight into it
+    prepareFrame(frame);
+    bool isTemplateFound = false;
+    if(passesPrecheck())
+        isTemplateFound = mBoardTracking ? detectWithTracking(frame) : detectAndParseTemplate(frame, mGrayFrame);
+    if(isTemplateFound)
+        mTemplateLocations.insert(mTemplateLocations.begin(), getCurrentTemplateLocation());
 
     if(mTemplateLocations.size() > mDelayBetweenCaptures)
         mTemplateLocations.pop_back();
     if(mTemplateLocations.size() == mDelayBetweenCaptures && isTemplateFound) {
         if(cv::norm(mTemplateLocations.front() - mTemplateLocations.back()) < mMaxTemplateOffset) {
-            saveFrameData();
-            bool isFrameBad = checkLastFrame();
+            std::lock_guard<std::mutex> pointsLock(mCalibData->pointsMutex);
+            bool isFrameBad = !saveAndCheckFrame(frame.size());
             if (!isFrameBad) {
-                std::string displayMessage = cv::format("Frame # %d captured", std::max(mCalibData->imagePoints.size(),
-                                                                                        mCalibData->allCharucoCorners.size()));
+                std::string displayMessage = cv::format("Frame # %d captured", (int)mCalibData->points.getViewsNumber());
                 if(!showOverlayMessage(displayMessage))
-                    showCaptureMessage(frame, displayMessage);
+                    showCaptureMessage(displayMessage);
                 mCapuredFrames++;
             }
             else {
                 std::string displayMessage = "Frame rejected";
                 if(!showOverlayMessage(displayMessage))
-                    showCaptureMessage(frame, displayMessage);
+                    showCaptureMessage(displayMessage);
             }
             mTemplateLocations.clear();
             mTemplateLocations.reserve(mDelayBetweenCaptures);
         }
     }
 
-    return frameCopy;
+    return frame;
+}
+
+bool CalibProcessor::saveAndCheckFrame(cv::Size imageSize)
+{
+    if(mCalibData->coverage.getImageSize() != imageSize)
+        mCalibData->coverage.rebuild(imageSize, mCalibData->points);
+    saveFrameData();
+    bool isFrameGood = !checkLastFrame();
+    if(isFrameGood && mCalibData->journal)
+        mCalibData->journal->addView(mCalibData->points, mCalibData->points.getViewsNumber() - 1);
+    return isFrameGood;
+}
+
+bool CalibProcessor::detectTemplate(const cv::Mat &image, std::vector<cv::Point2f> &imagePoints,
+                                    std::vector<int> &pointIds)
+{
+    mCurrentImagePoints.clear();
+    prepareFrame(image);
+    if(!detectAndParseTemplate(image, mGrayFrame))
+        return false;
+
+    if(mBoardType == TemplateType::chAruco) {
+        mCurrentCharucoCorners.copyTo(imagePoints);
+        mCurrentCharucoIds.copyTo(pointIds);
+    }
+    else {
+        imagePoints = mCurrentImagePoints;
+        pointIds.clear();
+    }
+    return true;
+}
+
+bool CalibProcessor::addView(cv::Size imageSize, const std::vector<cv::Point2f> &imagePoints,
+                             const std::vector<int> &pointIds)
+{
+    std::lock_guard<std::mutex> pointsLock(mCalibData->pointsMutex);
+    if(mBoardType == TemplateType::chAruco) {
+        mCurrentCharucoCorners = cv::Mat(imagePoints, true);
+        mCurrentCharucoIds = cv::Mat(pointIds, true);
+    }
+    else
+        mCurrentImagePoints = imagePoints;
+    return saveAndCheckFrame(imageSize);
 }
 
 bool CalibProcessor::isProcessed() const
@@ -339,6 +625,8 @@ void CalibProcessor::resetState()
 {
     mCapuredFrames = 0;
     mTemplateLocations.clear();
+    mTrackedRegion = cv::Rect();
+    mLastMotionFrame.release();
 }
 
 CalibProcessor::~CalibProcessor()
@@ -348,7 +636,7 @@ CalibProcessor::~CalibProcessor()
 
 ////////////////////////////////////////////
 
-void ShowProcessor::drawBoard(cv::Mat &img, cv::InputArray &points)
+void ShowProcessor::drawBoard(cv::Mat &img, cv::InputArray &points, double scale)
 {
     cv::Mat tmpView = cv::Mat::zeros(img.rows, img.cols, CV_8UC3);
     std::vector<cv::Point2f> templateHull;
@@ -356,54 +644,145 @@ void ShowProcessor::drawBoard(cv::Mat &img, cv::InputArray &points)
     cv::convexHull(points, templateHull);
     poly.resize(templateHull.size());
     for(size_t i=0; i<templateHull.size();i++)
-        poly[i] = cv::Point((int)(templateHull[i].x*mGridViewScale), (int)(templateHull[i].y*mGridViewScale));
+        poly[i] = cv::Point((int)(templateHull[i].x*scale), (int)(templateHull[i].y*scale));
     cv::fillConvexPoly(tmpView, poly, cv::Scalar(0, 255, 0), cv::LINE_AA);
     cv::addWeighted(tmpView, .2, img, 1, 0, img);
 }
 
-void ShowProcessor::drawGridPoints(const cv::Mat &frame)
+void ShowProcessor::drawGridPoints(cv::Mat &overlay, double scale)
 {
-    if(mBoardType != TemplateType::chAruco)
-        for(auto it = mCalibData->imagePoints.begin(); it != mCalibData->imagePoints.end(); ++it)
-            for(auto pointIt = (*it).begin(); pointIt != (*it).end(); ++pointIt)
-                cv::circle(frame, *pointIt, POINT_SIZE, cv::Scalar(0, 255, 0), 1, cv::LINE_AA);
+    for(size_t i = 0; i < mCalibData->points.getViewsNumber(); i++) {
+        const cv::Point2f* points = mCalibData->points.getImagePoints(i);
+        for(int j = 0; j < mCalibData->points.getPointsNumber(i); j++)
+            cv::circle(overlay, points[j]*scale, POINT_SIZE, cv::Scalar(0, 255, 0), 1, cv::LINE_AA);
+    }
+}
+
+bool ShowProcessor::drawCoverageHeatMap(cv::Mat &overlay, cv::Size frameSize)
+{
+    const CoverageIndex& coverage = mCalibData->coverage;
+    int maxCount = coverage.getMaxCellCount();
+    if(!maxCount || coverage.getImageSize() != frameSize)
+        return false;
+
+    int gridSize = coverage.getGridSize();
+    cv::Mat counts(gridSize, gridSize, CV_8U), colors;
+    for(int x = 0; x < gridSize; x++)
+        for(int y = 0; y < gridSize; y++)
+            counts.at<uchar>(y, x) = cv::saturate_cast<uchar>(255.*coverage.getCellCount(x, y) / maxCount);
+    cv::applyColorMap(counts, colors, cv::COLORMAP_JET);
+
+    colors *= HEAT_MAP_ALPHA;
+    double scaleX = (double)overlay.cols / frameSize.width, scaleY = (double)overlay.rows / frameSize.height;
+    for(int x = 0; x < gridSize; x++)
+        for(int y = 0; y < gridSize; y++)
+            if(coverage.getCellCount(x, y)) {
+                cv::Rect cell = coverage.getCellRect(x, y);
+                cv::Point topLeft(cvRound(cell.x*scaleX), cvRound(cell.y*scaleY));
+                cv::Point bottomRight(cvRound(cell.br().x*scaleX), cvRound(cell.br().y*scaleY));
+                cv::rectangle(overlay, cv::Rect(topLeft, bottomRight), colors.at<cv::Vec3b>(y, x), cv::FILLED);
+            }
+    return true;
+}
+
+void ShowProcessor::getOverlay(cv::Size frameSize, cv::Size previewSize, cv::Mat &overlay, cv::Mat &overlayMask)
+{
+    if(!mIsOverlayValid || mOverlayRevision != mCalibData->points.getRevision() || mOverlayMode != mVisMode ||
+            mOverlaySize != previewSize) {
+        ScopedTimer timer(ProfileStage::Drawing);
+        // a new layer every time, frames still being composited keep the old one
+        mOverlay = cv::Mat::zeros(previewSize, CV_8UC3);
+        mOverlayMask.release();
+        if(mVisMode == visualisationMode::HeatMap) {
+            if(!drawCoverageHeatMap(mOverlay, frameSize))
+                mOverlay.release();
+        }
+        else if(!mCalibData->points.empty()) {
+            drawGridPoints(mOverlay, (double)previewSize.width / frameSize.width);
+            // the faint anti-aliased fringe would be copied as a dark edge, so only the pixels
+            // drawn at least at half intensity are taken into the mask
+            cv::cvtColor(mOverlay, mOverlayMask, cv::COLOR_BGR2GRAY);
+            double maxIntensity = 0;
+            cv::minMaxLoc(mOverlayMask, 0, &maxIntensity);
+            cv::threshold(mOverlayMask, mOverlayMask, maxIntensity / 2, 255, cv::THRESH_BINARY);
+        }
+        else
+            mOverlay.release();
+        mIsOverlayValid = true;
+        mOverlayRevision = mCalibData->points.getRevision();
+        mOverlayMode = mVisMode;
+        mOverlaySize = previewSize;
+    }
+    overlay = mOverlay;
+    overlayMask = mOverlayMask;
+}
+
+// the heat map is blended additively, the points are copied through their mask
+void ShowProcessor::drawOverlay(const cv::Mat &frame, const cv::Mat &overlay, const cv::Mat &overlayMask)
+{
+    ScopedTimer timer(ProfileStage::Drawing);
+    if(overlay.size() != frame.size() || overlay.type() != frame.type())
+        return;
+    if(overlayMask.empty())
+        cv::add(frame, overlay, frame);
     else
-        for(auto it = mCalibData->allCharucoCorners.begin(); it != mCalibData->allCharucoCorners.end(); ++it)
-            for(int i = 0; i < (*it).size[0]; i++)
-                cv::circle(frame, cv::Point((int)(*it).at<float>(i, 0), (int)(*it).at<float>(i, 1)),
-                           POINT_SIZE, cv::Scalar(0, 255, 0), 1, cv::LINE_AA);
+        overlay.copyTo(frame, overlayMask);
 }
 
 ShowProcessor::ShowProcessor(Sptr<calibrationData> data, Sptr<calibController> controller, TemplateType board) :
-    mCalibData(data), mController(controller), mBoardType(board)
+    mCalibData(data), mController(controller), mBoardType(board), mFramePool(PREVIEW_BUFFERS_NUM)
 {
     mNeedUndistort = true;
+    mCalibData->undistortMap.setEnabled(mNeedUndistort);
     mVisMode = visualisationMode::Grid;
     mGridViewScale = 0.5;
-    mTextSize = VIDEO_TEXT_SIZE;
+    mIsOverlayValid = false;
+    mOverlayRevision = 0;
+    mOverlayMode = mVisMode;
+    mPreviewWidth = 0;
+}
+
+cv::Mat ShowProcessor::getPreview(const cv::Mat &frame)
+{
+    cv::Size previewSize = getPreviewSize(frame.size(), mPreviewWidth);
+    if(previewSize == frame.size())
+        return frame;
+
+    ScopedTimer timer(ProfileStage::Downscale);
+    cv::Mat preview = mFramePool.acquire(previewSize, frame.type());
+    cv::resize(frame, preview, previewSize, 0, 0, cv::INTER_AREA);
+    return preview;
 }
 
 cv::Mat ShowProcessor::processFrame(const cv::Mat &frame)
 {
+    // the input frame is owned by this stage, so a full size preview is drawn straight into it
+    cv::Mat preview = getPreview(frame);
     if(mCalibData->cameraMatrix.size[0] && mCalibData->distCoeffs.size[0]) {
-        mTextSize = VIDEO_TEXT_SIZE * (double) frame.cols / IMAGE_MAX_WIDTH;
+        std::unique_lock<std::mutex> pointsLock(mCalibData->pointsMutex);
+        double textSizeScale = OVERLAY_TEXT_SIZE * (double) preview.cols / IMAGE_MAX_WIDTH;
         cv::Scalar textColor = cv::Scalar(0,0,255);
-        cv::Mat frameCopy;
-
-        if (mNeedUndistort && mController->getFramesNumberState()) {
-            if(mVisMode == visualisationMode::Grid)
-                drawGridPoints(frame);
-            cv::remap(frame, frameCopy, mCalibData->undistMap1, mCalibData->undistMap2, cv::INTER_LINEAR);
+        cv::Mat frameCopy = preview, overlay, overlayMask, undistMap1, undistMap2;
+        bool needUndistort = mNeedUndistort && mController->getFramesNumberState() &&
+                mCalibData->undistortMap.getMaps(undistMap1, undistMap2) && undistMap1.size() == preview.size();
+        if(mVisMode != visualisationMode::Window)
+            getOverlay(frame.size(), preview.size(), overlay, overlayMask);
+        pointsLock.unlock();
+
+        if(!overlay.empty())
+            drawOverlay(preview, overlay, overlayMask);
+        if(needUndistort) {
+            {
+                ScopedTimer timer(ProfileStage::Remap);
+                frameCopy = mFramePool.acquire(preview.size(), preview.type());
+                cv::remap(preview, frameCopy, undistMap1, undistMap2, cv::INTER_LINEAR);
+            }
             int baseLine = 100;
-            cv::Size textSize = cv::getTextSize("Undistorted view", 1, mTextSize, 2, &baseLine);
-            cv::Point textOrigin(baseLine, frame.rows - (int)(2.5*textSize.height));
-            cv::putText(frameCopy, "Undistorted view", textOrigin, 1, mTextSize, textColor, 2, cv::LINE_AA);
-        }
-        else {
-            frame.copyTo(frameCopy);
-            if(mVisMode == visualisationMode::Grid)
-                drawGridPoints(frameCopy);
+            cv::Size textSize = cv::getTextSize("Undistorted view", 1, textSizeScale, 2, &baseLine);
+            cv::Point textOrigin(baseLine, preview.rows - (int)(2.5*textSize.height));
+            cv::putText(frameCopy, "Undistorted view", textOrigin, 1, textSizeScale, textColor, 2, cv::LINE_AA);
         }
+        pointsLock.lock();
         std::string displayMessage;
         if(mCalibData->stdDeviations.at<double>(0) == 0)
             displayMessage = cv::format("F = %d RMS = %.3f", (int)mCalibData->cameraMatrix.at<double>(0,0), mCalibData->totalAvgErr);
@@ -414,9 +793,9 @@ cv::Mat ShowProcessor::processFrame(const cv::Mat &frame)
             displayMessage.append(" OK");
 
         int baseLine = 100;
-        cv::Size textSize = cv::getTextSize(displayMessage, 1, mTextSize - 1, 2, &baseLine);
+        cv::Size textSize = cv::getTextSize(displayMessage, 1, textSizeScale - 1, 2, &baseLine);
         cv::Point textOrigin = cv::Point(baseLine, 2*textSize.height);
-        cv::putText(frameCopy, displayMessage, textOrigin, 1, mTextSize - 1, textColor, 2, cv::LINE_AA);
+        cv::putText(frameCopy, displayMessage, textOrigin, 1, textSizeScale - 1, textColor, 2, cv::LINE_AA);
 
         if(mCalibData->stdDeviations.at<double>(0) == 0)
             displayMessage = cv::format("DF = %.2f", mCalibData->stdDeviations.at<double>(1)*sigmaMult);
@@ -425,11 +804,11 @@ cv::Mat ShowProcessor::processFrame(const cv::Mat &frame)
                                                     mCalibData->stdDeviations.at<double>(1)*sigmaMult);
         if(mController->getConfidenceIntrervalsState() && mController->getFramesNumberState())
             displayMessage.append(" OK");
-        cv::putText(frameCopy, displayMessage, cv::Point(baseLine, 4*textSize.height), 1, mTextSize - 1, textColor, 2, cv::LINE_AA);
+        cv::putText(frameCopy, displayMessage, cv::Point(baseLine, 4*textSize.height), 1, textSizeScale - 1, textColor, 2, cv::LINE_AA);
 
         if(mController->getCommonCalibrationState()) {
             displayMessage = cv::format("Calibration is done");
-            cv::putText(frameCopy, displayMessage, cv::Point(baseLine, 6*textSize.height), 1, mTextSize - 1, textColor, 2, cv::LINE_AA);
+            cv::putText(frameCopy, displayMessage, cv::Point(baseLine, 6*textSize.height), 1, textSizeScale - 1, textColor, 2, cv::LINE_AA);
         }
         int calibFlags = mController->getNewFlags();
         displayMessage = "";
@@ -440,11 +819,11 @@ cv::Mat ShowProcessor::processFrame(const cv::Mat &frame)
         displayMessage.append(cv::format("K1=%.2f K2=%.2f K3=%.2f", mCalibData->distCoeffs.at<double>(0), mCalibData->distCoeffs.at<double>(1),
                                          mCalibData->distCoeffs.at<double>(4)));
         cv::putText(frameCopy, displayMessage, cv::Point(baseLine, frameCopy.rows - (int)(1.5*textSize.height)),
-                    1, mTextSize - 1, textColor, 2, cv::LINE_AA);
+                    1, textSizeScale - 1, textColor, 2, cv::LINE_AA);
         return frameCopy;
     }
 
-    return frame;
+    return preview;
 }
 
 bool ShowProcessor::isProcessed() const
@@ -457,6 +836,11 @@ void ShowProcessor::resetState()
 
 }
 
+bool ShowProcessor::isStateless() const
+{
+    return true;
+}
+
 void ShowProcessor::setVisualizationMode(visualisationMode mode)
 {
     mVisMode = mode;
@@ -464,53 +848,58 @@ void ShowProcessor::setVisualizationMode(visualisationMode mode)
 
 void ShowProcessor::switchVisualizationMode()
 {
-    if(mVisMode == visualisationMode::Grid) {
+    if(mVisMode == visualisationMode::Grid)
+        mVisMode = visualisationMode::HeatMap;
+    else if(mVisMode == visualisationMode::HeatMap) {
         mVisMode = visualisationMode::Window;
         updateBoardsView();
     }
     else {
         mVisMode = visualisationMode::Grid;
-        cv::destroyWindow(gridWindowName);
+        Display::instance().destroyWindow(gridWindowName);
     }
 }
 
 void ShowProcessor::clearBoardsView()
 {
-    cv::imshow(gridWindowName, cv::Mat());
+    Display::instance().show(gridWindowName, cv::Mat());
 }
 
 void ShowProcessor::updateBoardsView()
 {
     if(mVisMode == visualisationMode::Window) {
         cv::Size originSize = mCalibData->imageSize;
-        cv::Mat altGridView = cv::Mat::zeros((int)(originSize.height*mGridViewScale), (int)(originSize.width*mGridViewScale), CV_8UC3);
-        if(mBoardType != TemplateType::chAruco)
-            for(auto it = mCalibData->imagePoints.begin(); it != mCalibData->imagePoints.end(); ++it)
-                if(mBoardType != TemplateType::DoubleAcirclesGrid)
-                    drawBoard(altGridView, *it);
-                else {
-                    size_t pointsNum = (*it).size()/2;
-                    std::vector<cv::Point2f> points(pointsNum);
-                    std::copy_n((*it).begin(), pointsNum, points.begin());
-                    drawBoard(altGridView, points);
-                    std::copy_n((*it).begin() + pointsNum, pointsNum, points.begin());
-                    drawBoard(altGridView, points);
-                }
-        else
-            for(auto it = mCalibData->allCharucoCorners.begin(); it != mCalibData->allCharucoCorners.end(); ++it)
-                drawBoard(altGridView, *it);
-        cv::imshow(gridWindowName, altGridView);
+        double scale = mGridViewScale * getPreviewSize(originSize, mPreviewWidth).width / originSize.width;
+        cv::Mat altGridView = cv::Mat::zeros((int)(originSize.height*scale), (int)(originSize.width*scale), CV_8UC3);
+        for(size_t i = 0; i < mCalibData->points.getViewsNumber(); i++) {
+            cv::Mat points = mCalibData->points.getImagePointsMat(i);
+            if(mBoardType != TemplateType::DoubleAcirclesGrid)
+                drawBoard(altGridView, points, scale);
+            else {
+                int pointsNum = points.cols/2;
+                drawBoard(altGridView, points.colRange(0, pointsNum), scale);
+                drawBoard(altGridView, points.colRange(pointsNum, 2*pointsNum), scale);
+            }
+        }
+        Display::instance().show(gridWindowName, altGridView);
     }
 }
 
+void ShowProcessor::setPreviewWidth(int width)
+{
+    mPreviewWidth = width;
+}
+
 void ShowProcessor::switchUndistort()
 {
     mNeedUndistort = !mNeedUndistort;
+    mCalibData->undistortMap.setEnabled(mNeedUndistort);
 }
 
 void ShowProcessor::setUndistort(bool isEnabled)
 {
     mNeedUndistort = isEnabled;
+    mCalibData->undistortMap.setEnabled(mNeedUndistort);
 }
 
 ShowProcessor::~ShowProcessor()
@@ -0,0 +1,63 @@
+#include "frameRingBuffer.hpp"
+#include <algorithm>
+
+using namespace calib;
+
+FrameRingBuffer::FrameRingBuffer(size_t slotsNum, FrameDropPolicy policy) :
+    mSlots(std::max(slotsNum, (size_t)1)), mPolicy(policy)
+{
+    mHead = 0;
+    mCount = 0;
+    mIsClosed = false;
+}
+
+bool FrameRingBuffer::push(cv::Mat &frame)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mPolicy == FrameDropPolicy::Block)
+        mNotFull.wait(lock, [this] { return mIsClosed || mCount < mSlots.size(); });
+    if(mIsClosed)
+        return false;
+
+    std::swap(mSlots[mHead], frame);
+    mHead = (mHead + 1) % mSlots.size();
+    mCount = std::min(mCount + 1, mSlots.size());
+    mNotEmpty.notify_one();
+    return true;
+}
+
+bool FrameRingBuffer::pop(cv::Mat &frame, bool wait)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(wait)
+        mNotEmpty.wait(lock, [this] { return mIsClosed || mCount > 0; });
+    if(mCount == 0)
+        return false;
+
+    size_t slotsNum = mSlots.size();
+    if(mPolicy == FrameDropPolicy::DropOldest) {
+        std::swap(mSlots[(mHead + slotsNum - 1) % slotsNum], frame);
+        mCount = 0;
+    }
+    else {
+        std::swap(mSlots[(mHead + slotsNum - mCount) % slotsNum], frame);
+        mCount--;
+    }
+    mNotFull.notify_one();
+    return true;
+}
+
+void FrameRingBuffer::close()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIsClosed = true;
+    mNotEmpty.notify_all();
+    mNotFull.notify_all();
+}
+
+void FrameRingBuffer::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mCount = 0;
+    mNotFull.notify_all();
+}
@@ -1,5 +1,8 @@
 #include "linalg.hpp"
 
+// systems up to this size are factorized in place without LAPACK
+#define CHOLESKY_NATIVE_MAX_SIZE 32
+
 #ifdef USE_LAPACK
 
 #ifdef HAVE_VECLIB
@@ -76,7 +79,8 @@ bool cvfork::solve(InputArray _src, const InputArray _src2arg, OutputArray _dst,
         int elem_size = CV_ELEM_SIZE(type);
         bool copy_rhs=false;
         int buf_size=0;
-        AutoBuffer<uchar> buffer;
+        // the work buffer only grows, so repeated solves of the same size don't allocate
+        static thread_local std::vector<uchar> buffer;
         uchar* ptr;
         char N[] = {'N', '\0'}, L[] = {'L', '\0'};
 
@@ -134,8 +138,9 @@ bool cvfork::solve(InputArray _src, const InputArray _src2arg, OutputArray _dst,
 
         lwork = cvRound(type == CV_32F ? (double)fwork1 : work1);
         buf_size += lwork*elem_size;
-        buffer.allocate(buf_size);
-        ptr = (uchar*)buffer;
+        if( buffer.size() < (size_t)buf_size )
+            buffer.resize(buf_size);
+        ptr = buffer.data();
 
         Mat at(n, m_, type, ptr);
         ptr += n*m_*elem_size;
@@ -536,3 +541,68 @@ double cvfork::invert( InputArray _src, OutputArray _dst, int method )
 }
 
 #endif //USE_LAPACK
+
+// in-place factorization A = L*L^t in the lower triangle, then forward and back substitution
+static bool choleskySmall(double* a, size_t astep, double* x, size_t xstep, int n, int nb)
+{
+    for(int i = 0; i < n; i++) {
+        double* ai = a + i*astep;
+        for(int j = 0; j < i; j++) {
+            const double* aj = a + j*astep;
+            double s = ai[j];
+            for(int k = 0; k < j; k++)
+                s -= ai[k]*aj[k];
+            ai[j] = s / aj[j];
+        }
+        double s = ai[i];
+        for(int k = 0; k < i; k++)
+            s -= ai[k]*ai[k];
+        if(!(s > 0))
+            return false;
+        ai[i] = std::sqrt(s);
+    }
+
+    for(int c = 0; c < nb; c++) {
+        for(int i = 0; i < n; i++) {
+            const double* ai = a + i*astep;
+            double s = x[i*xstep + c];
+            for(int k = 0; k < i; k++)
+                s -= ai[k]*x[k*xstep + c];
+            x[i*xstep + c] = s / ai[i];
+        }
+        for(int i = n - 1; i >= 0; i--) {
+            double s = x[i*xstep + c];
+            for(int k = i + 1; k < n; k++)
+                s -= a[k*astep + i]*x[k*xstep + c];
+            x[i*xstep + c] = s / a[i*astep + i];
+        }
+    }
+    return true;
+}
+
+bool cvfork::solveCholesky(cv::InputArray _src, cv::InputArray _src2arg, cv::OutputArray _dst)
+{
+    cv::Mat src = _src.getMat(), src2 = _src2arg.getMat();
+    CV_Assert( src.type() == src2.type() && src.rows == src.cols && src.rows == src2.rows );
+
+    if( src.type() == CV_64F && src.rows <= CHOLESKY_NATIVE_MAX_SIZE )
+    {
+        int n = src.rows;
+        double buffer[CHOLESKY_NATIVE_MAX_SIZE*CHOLESKY_NATIVE_MAX_SIZE];
+        cv::Mat a(n, n, CV_64F, buffer);
+        src.copyTo(a);
+        _dst.create(n, src2.cols, CV_64F);
+        cv::Mat dst = _dst.getMat();
+        src2.copyTo(dst);
+
+        bool result = choleskySmall(buffer, n, dst.ptr<double>(), dst.step / sizeof(double), n, src2.cols);
+        if( !result )
+            dst = cv::Scalar(0);
+        return result;
+    }
+#ifndef USE_LAPACK
+    return cv::solve(src, src2, _dst, cv::DECOMP_CHOLESKY);
+#else
+    return cvfork::solve(src, src2, _dst, cv::DECOMP_CHOLESKY);
+#endif
+}
@@ -4,26 +4,36 @@
 #include <opencv2/cvconfig.h>
 #include <opencv2/highgui.hpp>
 #include <string>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <vector>
 #include <exception>
 #include <algorithm>
 #include <iostream>
-#include <chrono>
+#include <sstream>
 
 #include "calibCommon.hpp"
 #include "calibPipeline.hpp"
+#include "calibWorker.hpp"
+#include "display.hpp"
+#include "batchCalibration.hpp"
+#include "rigCalibration.hpp"
 #include "frameProcessor.hpp"
 #include "cvCalibrationFork.hpp"
 #include "calibController.hpp"
 #include "parametersController.hpp"
 #include "rotationConverters.hpp"
+#include "profiler.hpp"
 
 using namespace calib;
 
 const std::string keys  =
         "{n        | 20      | Number of frames for calibration }"
         "{v        |         | Input from video file }"
+        "{b        |         | Headless calibration over images (directory or glob pattern) }"
         "{ci       | 0       | DefaultCameraID }"
+        "{cameras  |         | Comma-separated IDs of cameras calibrated together, one output file per camera }"
         "{flip     | false   | Vertical flip of input frames }"
         "{t        | circles | Template for calibration (circles, chessboard, dualCircles, chAruco) }"
         "{sz       | 16.3    | Distance between two nearest centers of circles or squares on calibration board}"
@@ -35,19 +45,13 @@ const std::string keys  =
         "{vis      | grid    | Captured boards visualisation (grid, window)}"
         "{d        | 1     | Min delay between captures}"
         "{pf       | defaultConfig.xml| Advanced application parameters}"
+        "{prof     | false   | Print timings of capture, detection, drawing and solver stages at exit}"
+        "{trace    |         | Write per-frame stage timings to file (.json for chrome://tracing, CSV otherwise)}"
+        "{journal  |         | Binary session journal of the captured views}"
+        "{resume   | false   | Continue the session stored in the journal}"
+        "{replay   |         | Calibrate off-line from the views of a session journal}"
         "{help     |         | Print help}";
 
-bool calib::showOverlayMessage(const std::string& message)
-{
-#ifdef HAVE_QT
-    cv::displayOverlay(mainWindowName, message, OVERLAY_DELAY);
-    return true;
-#else
-    std::count << message << std::endl;
-    return false;
-#endif
-}
-
 void deleteButton(int state, void* data)
 {
     state++;
@@ -62,14 +66,6 @@ void deleteAllButton(int state, void* data)
     calib::showOverlayMessage("All frames deleted");
 }
 
-void undistortButton(int state, void* data)
-{
-    ShowProcessor* processor = static_cast<ShowProcessor*>(((Sptr<FrameProcessor>*)data)->get());
-    processor->setUndistort(static_cast<bool>(state));
-    calib::showOverlayMessage(std::string("Undistort is ") +
-                       (static_cast<bool>(state) ? std::string("on") : std::string("off")));
-}
-
 void saveCurrentParamsButton(int state, void* data)
 {
     state++;
@@ -77,11 +73,65 @@ void saveCurrentParamsButton(int state, void* data)
         calib::showOverlayMessage("Calibration parameters saved");
 }
 
-void switchVisualisationModeButton(int state, void* data)
+static bool startJournal(const std::string& fileName, bool resume, Sptr<calibrationData> data,
+                         const cv::Size& sourceSize)
 {
-    state++;
-    ShowProcessor* processor = static_cast<ShowProcessor*>(((Sptr<FrameProcessor>*)data)->get());
-    processor->switchVisualizationMode();
+    if(resume) {
+        std::shared_ptr<const BoardModel> board = data->points.getBoardModel();
+        cv::Size imageSize;
+        if(!SessionJournal::load(fileName, data->points, imageSize, board.get())) {
+            // keep the old journal untouched, it can't be continued with this board
+            data->points.setBoardModel(board);
+            return false;
+        }
+        if(imageSize != sourceSize) {
+            std::cout << "Unable to resume " << fileName << ": journal image size " << imageSize
+                      << " differs from the capture size " << sourceSize << std::endl;
+            data->points.setBoardModel(board);
+            return false;
+        }
+        data->imageSize = imageSize;
+        data->coverage.rebuild(imageSize, data->points);
+        std::cout << "Resumed " << data->points.getViewsNumber() << " views from " << fileName << std::endl;
+    }
+    else
+        data->imageSize = sourceSize;
+
+    data->journal = std::make_shared<SessionJournal>();
+    if(!data->journal->open(fileName, data->points, data->imageSize)) {
+        std::cout << "Unable to write journal " << fileName << std::endl;
+        data->journal.reset();
+        return false;
+    }
+    return true;
+}
+
+// parses a comma-separated list of non-negative camera IDs, at least one ID is required
+static bool parseCameraIds(const std::string& list, std::vector<int>& ids)
+{
+    std::stringstream idsStream(list);
+    std::string id;
+    while(std::getline(idsStream, id, ',')) {
+        if(id.empty())
+            continue;
+        char* idEnd = nullptr;
+        errno = 0;
+        long value = std::strtol(id.c_str(), &idEnd, 10);
+        if(idEnd == id.c_str() || *idEnd != '\0' || errno == ERANGE || value < 0 || value > INT_MAX)
+            return false;
+        ids.push_back((int)value);
+    }
+    return !ids.empty();
+}
+
+static void reportProfile(const std::string& traceFileName)
+{
+    Profiler& profiler = Profiler::instance();
+    if(!profiler.isEnabled())
+        return;
+    profiler.printSummary(std::cout);
+    if(!traceFileName.empty() && !profiler.writeTrace(traceFileName))
+        std::cout << "Unable to write trace to " << traceFileName << std::endl;
 }
 
 int main(int argc, char** argv)
@@ -91,12 +141,15 @@ int main(int argc, char** argv)
         parser.printMessage();
         return 0;
     }
-    std::cout << consoleHelp << std::endl;
     parametersController paramsController;
 
     if(!paramsController.loadFromParser(parser))
         return 0;
 
+    std::string traceFileName = parser.get<std::string>("trace");
+    if(parser.get<bool>("prof") || !traceFileName.empty())
+        Profiler::instance().enable(!traceFileName.empty());
+
     captureParameters capParams = paramsController.getCaptureParameters();
     internalParameters intParams = paramsController.getInternalParameters();
 
@@ -104,86 +157,147 @@ int main(int argc, char** argv)
                                                        intParams.solverMaxIters, intParams.solverEps);
     Sptr<calibrationData> globalData(new calibrationData);
     if(!parser.has("v")) globalData->imageSize = capParams.cameraResolution;
+    globalData->coverage.setGridSize(intParams.coverageGridSize);
 
     int calibrationFlags = 0;
     if(intParams.fastSolving) calibrationFlags |= CALIB_USE_QR;
+    if(intParams.schurSolving) calibrationFlags |= CALIB_USE_SCHUR;
+    if(intParams.choleskySolving) calibrationFlags |= CALIB_USE_CHOLESKY;
+    if(intParams.robustLoss == 1) calibrationFlags |= CALIB_ROBUST_HUBER;
+    if(intParams.robustLoss == 2) calibrationFlags |= CALIB_ROBUST_CAUCHY;
     Sptr<calibController> controller(new calibController(globalData, calibrationFlags,
                                                          parser.get<bool>("ft"), capParams.minFramesNum));
+    controller->setParallelTuning(intParams.parallelTuning);
     Sptr<calibDataController> dataController(new calibDataController(globalData, capParams.maxFramesNum,
                                                                      intParams.filterAlpha));
     dataController->setParametersFileName(parser.get<std::string>("of"));
+    dataController->setPreviewWidth(capParams.previewWidth);
+
+    std::string journalFileName = parser.get<std::string>("journal");
+    if(parser.has("replay")) {
+        BatchCalibration batch(capParams, globalData, dataController, calibrationFlags, solverTermCrit,
+                               intParams.robustLossScale);
+        bool isCalibrated = batch.replay(parser.get<std::string>("replay"));
+        reportProfile(traceFileName);
+        return isCalibrated ? 0 : 1;
+    }
+    if(capParams.captureMethod == InputType::Pictures) {
+        BatchCalibration batch(capParams, globalData, dataController, calibrationFlags, solverTermCrit,
+                               intParams.robustLossScale);
+        batch.setJournalFileName(journalFileName);
+        bool isCalibrated = batch.run();
+        reportProfile(traceFileName);
+        return isCalibrated ? 0 : 1;
+    }
+    std::cout << consoleHelp << std::endl;
+    Display::instance().start();
+
+    if(parser.has("cameras")) {
+        std::vector<int> cameraIds;
+        if(!parseCameraIds(parser.get<std::string>("cameras"), cameraIds)) {
+            std::cout << "Invalid camera IDs: " << parser.get<std::string>("cameras") << std::endl;
+            parser.printMessage();
+            Display::instance().stop();
+            return 1;
+        }
+        bool isCalibrated = false;
+        try {
+            RigCalibration rig(capParams, intParams, calibrationFlags, parser.get<bool>("ft"),
+                               solverTermCrit, parser.get<std::string>("of"));
+            isCalibrated = rig.run(cameraIds);
+        }
+        catch (const std::exception& exp) {
+            std::cout << exp.what() << std::endl;
+        }
+        Display::instance().stop();
+        reportProfile(traceFileName);
+        return isCalibrated ? 0 : 1;
+    }
 
     Sptr<FrameProcessor> capProcessor, showProcessor;
     capProcessor = Sptr<FrameProcessor>(new CalibProcessor(globalData, capParams));
     showProcessor = Sptr<FrameProcessor>(new ShowProcessor(globalData, controller, capParams.board));
+    static_cast<ShowProcessor*>(showProcessor.get())->setPreviewWidth(capParams.previewWidth);
 
     if(parser.get<std::string>("vis").find("window") == 0) {
         static_cast<ShowProcessor*>(showProcessor.get())->setVisualizationMode(visualisationMode::Window);
-        cv::namedWindow(gridWindowName);
-        cv::moveWindow(gridWindowName, 1280, 500);
+        Display::instance().createWindow(gridWindowName, cv::Point(1280, 500));
     }
 
+    Sptr<CalibWorker> calibWorker(new CalibWorker(solverTermCrit, intParams.robustLossScale));
     Sptr<CalibPipeline> pipeline(new CalibPipeline(capParams));
+    pipeline->setCalibWorker(calibWorker);
+    bool isCalibrationPending = false;
+    if(!journalFileName.empty()) {
+        // a journal is only resumed at the resolution it was recorded with
+        try {
+            pipeline->open();
+        }
+        catch (const std::runtime_error& exp) {
+            std::cout << exp.what() << std::endl;
+            Display::instance().stop();
+            return 1;
+        }
+        if(startJournal(journalFileName, parser.get<bool>("resume"), globalData, pipeline->getImageSize()))
+            isCalibrationPending = globalData->points.getViewsNumber() >= (size_t)capParams.minFramesNum;
+    }
     std::vector<Sptr<FrameProcessor>> processors;
     processors.push_back(capProcessor);
     processors.push_back(showProcessor);
 
-    cv::namedWindow(mainWindowName);
-    cv::moveWindow(mainWindowName, 10, 10);
+    Display::instance().createWindow(mainWindowName, cv::Point(10, 10));
 #ifdef HAVE_QT
-    cv::createButton("Delete last frame", deleteButton, &dataController, cv::QT_PUSH_BUTTON);
-    cv::createButton("Delete all frames", deleteAllButton, &dataController, cv::QT_PUSH_BUTTON);
-    cv::createButton("Undistort", undistortButton, &showProcessor, CV_CHECKBOX, false);
-    cv::createButton("Save current parameters", saveCurrentParamsButton, &dataController, CV_PUSH_BUTTON);
-    cv::createButton("Switch visualisation mode", switchVisualisationModeButton, &showProcessor, CV_PUSH_BUTTON);
+    // the buttons post the hot keys, so their actions run here and not on the display thread
+    Display::instance().createButton("Delete last frame", 'r', cv::QT_PUSH_BUTTON);
+    Display::instance().createButton("Delete all frames", 'd', cv::QT_PUSH_BUTTON);
+    Display::instance().createButton("Undistort", 'u', cv::QT_CHECKBOX, true);
+    Display::instance().createButton("Save current parameters", 's', cv::QT_PUSH_BUTTON);
+    Display::instance().createButton("Switch visualisation mode", 'v', cv::QT_PUSH_BUTTON);
 #endif
     try {
         while(true)
         {
             auto exitStatus = pipeline->start(processors);
             if (exitStatus == PipelineExitStatus::Finished) {
+                calibWorker->cancel();
                 if(controller->getCommonCalibrationState())
                     saveCurrentParamsButton(0, &dataController);
                 break;
             }
-            else if (exitStatus == PipelineExitStatus::Calibrate) {
+            else if (exitStatus == PipelineExitStatus::Calibrate)
+                isCalibrationPending = true;
+            else if (exitStatus == PipelineExitStatus::CalibrationReady) {
+                calibrationResult result;
+                if(calibWorker->fetchResult(result)) {
+                    if(!result.errorMessage.empty())
+                        std::cout << result.errorMessage << std::endl;
+                    else if(result.removalsCount == globalData->removalsCount) {
+                        globalData->cameraMatrix = result.cameraMatrix;
+                        globalData->distCoeffs = result.distCoeffs;
+                        globalData->stdDeviations = result.stdDeviations;
+                        globalData->perViewErrors = result.perViewErrors;
+                        globalData->rvecs = result.rvecs;
+                        globalData->tvecs = result.tvecs;
+                        globalData->totalAvgErr = result.totalAvgErr;
 
-                dataController->rememberCurrentParameters();
-                globalData->imageSize = pipeline->getImageSize();
-                calibrationFlags = controller->getNewFlags();
-
-                using namespace std::chrono;
-                auto startPoint = high_resolution_clock::now();
-                if(capParams.board != TemplateType::chAruco) {
-                    globalData->totalAvgErr =
-                            cvfork::calibrateCamera(globalData->objectPoints, globalData->imagePoints,
-                                                    globalData->imageSize, globalData->cameraMatrix,
-                                                    globalData->distCoeffs, cv::noArray(), cv::noArray(),
-                                                    globalData->stdDeviations, globalData->perViewErrors,
-                                                    calibrationFlags, solverTermCrit);
-                }
-                else {
-                    cv::Ptr<cv::aruco::Dictionary> dictionary =
-                            cv::aruco::getPredefinedDictionary(cv::aruco::PREDEFINED_DICTIONARY_NAME(capParams.charucoDictName));
-                    cv::Ptr<cv::aruco::CharucoBoard> charucoboard =
-                                cv::aruco::CharucoBoard::create(capParams.boardSize.width, capParams.boardSize.height,
-                                                                capParams.charucoSquareLenght, capParams.charucoMarkerSize, dictionary);
-                    globalData->totalAvgErr =
-                            cvfork::calibrateCameraCharuco(globalData->allCharucoCorners, globalData->allCharucoIds,
-                                                           charucoboard, globalData->imageSize,
-                                                           globalData->cameraMatrix, globalData->distCoeffs,
-                                                           cv::noArray(), cv::noArray(), globalData->stdDeviations,
-                                                           globalData->perViewErrors, calibrationFlags, solverTermCrit);
+                        dataController->updateUndistortMap();
+                        dataController->printParametersToConsole(std::cout);
+                        std::cout << "Calibration time: " << result.calibrationTime << "\n";
+                        if(result.isTuned)
+                            controller->setTunedFlags(result.flags);
+                        controller->updateState();
+                        // views captured while solving have no errors yet, so calibrate again instead of filtering
+                        if(globalData->points.getViewsNumber() == result.framesNum)
+                            for(int j = 0; j < capParams.calibrationStep; j++)
+                                dataController->filterFrames();
+                        else
+                            isCalibrationPending = true;
+                        static_cast<ShowProcessor*>(showProcessor.get())->updateBoardsView();
+                    }
+                    // frames were deleted while solving, the result is stale and the rest is solved again
+                    else if(globalData->points.getViewsNumber() >= (size_t)capParams.minFramesNum)
+                        isCalibrationPending = true;
                 }
-                auto endPoint = high_resolution_clock::now();
-
-                dataController->updateUndistortMap();
-                dataController->printParametersToConsole(std::cout);
-                std::cout << "Calibration time: " << (duration_cast<duration<double>>(endPoint - startPoint)).count() << "\n";
-                controller->updateState();
-                for(int j = 0; j < capParams.calibrationStep; j++)
-                    dataController->filterFrames();
-                static_cast<ShowProcessor*>(showProcessor.get())->updateBoardsView();
             }
             else if (exitStatus == PipelineExitStatus::DeleteLastFrame) {
                 deleteButton(0, &dataController);
@@ -198,16 +312,33 @@ int main(int argc, char** argv)
             }
             else if (exitStatus == PipelineExitStatus::SwitchUndistort)
                 static_cast<ShowProcessor*>(showProcessor.get())->switchUndistort();
+            else if (exitStatus == PipelineExitStatus::EnableUndistort ||
+                     exitStatus == PipelineExitStatus::DisableUndistort)
+                static_cast<ShowProcessor*>(showProcessor.get())->setUndistort(
+                            exitStatus == PipelineExitStatus::EnableUndistort);
             else if (exitStatus == PipelineExitStatus::SwitchVisualisation)
                 static_cast<ShowProcessor*>(showProcessor.get())->switchVisualizationMode();
 
-            for (auto it = processors.begin(); it != processors.end(); ++it)
-                (*it)->resetState();
+            if(isCalibrationPending && !calibWorker->isBusy()) {
+                dataController->rememberCurrentParameters();
+                globalData->imageSize = pipeline->getImageSize();
+                int flags = controller->getNewFlags();
+                if(intParams.incrementalSolving && globalData->cameraMatrix.total())
+                    flags |= cv::CALIB_USE_INTRINSIC_GUESS | CALIB_USE_INITIAL_EXTRINSICS;
+                isCalibrationPending = !calibWorker->requestCalibration(*globalData, flags,
+                                                                        controller->getCandidateFlags());
+            }
+
+            if(exitStatus != PipelineExitStatus::CalibrationReady)
+                for (auto it = processors.begin(); it != processors.end(); ++it)
+                    (*it)->resetState();
         }
     }
     catch (std::runtime_error exp) {
         std::cout << exp.what() << std::endl;
     }
+    Display::instance().stop();
+    reportProfile(traceFileName);
 
     return 0;
 }
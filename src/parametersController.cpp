@@ -38,10 +38,22 @@ bool calib::parametersController::loadFromFile(const std::string &inputFileName)
     readFromNode(reader["calibration_step"], mCapParams.calibrationStep);
     readFromNode(reader["max_frames_num"], mCapParams.maxFramesNum);
     readFromNode(reader["min_frames_num"], mCapParams.minFramesNum);
+    readFromNode(reader["processing_threads"], mCapParams.processingThreads);
+    readFromNode(reader["board_tracking"], mCapParams.boardTracking);
+    readFromNode(reader["board_precheck"], mCapParams.boardPrecheck);
+    readFromNode(reader["motion_gate"], mCapParams.motionGate);
+    readFromNode(reader["preview_width"], mCapParams.previewWidth);
     readFromNode(reader["solver_eps"], mInternalParameters.solverEps);
     readFromNode(reader["solver_max_iters"], mInternalParameters.solverMaxIters);
     readFromNode(reader["fast_solver"], mInternalParameters.fastSolving);
+    readFromNode(reader["schur_solver"], mInternalParameters.schurSolving);
+    readFromNode(reader["cholesky_solver"], mInternalParameters.choleskySolving);
+    readFromNode(reader["incremental_solver"], mInternalParameters.incrementalSolving);
+    readFromNode(reader["parallel_tuning"], mInternalParameters.parallelTuning);
+    readFromNode(reader["robust_loss"], mInternalParameters.robustLoss);
+    readFromNode(reader["robust_loss_scale"], mInternalParameters.robustLossScale);
     readFromNode(reader["frame_filter_conv_param"], mInternalParameters.filterAlpha);
+    readFromNode(reader["coverage_grid_size"], mInternalParameters.coverageGridSize);
 
     bool retValue =
             checkAssertion(mCapParams.charucoDictName >= 0, "Dict name must be >= 0") &&
@@ -49,9 +61,15 @@ bool calib::parametersController::loadFromFile(const std::string &inputFileName)
             checkAssertion(mCapParams.charucoSquareLenght > 0, "Square size must be positive") &&
             checkAssertion(mCapParams.minFramesNum > 1, "Minimal number of frames for calibration < 1") &&
             checkAssertion(mCapParams.calibrationStep > 0, "Calibration step must be positive") &&
+            checkAssertion(mCapParams.processingThreads >= 0, "Number of processing threads must be non-negative") &&
+            checkAssertion(mCapParams.previewWidth >= 0, "Preview width must be non-negative") &&
             checkAssertion(mCapParams.maxFramesNum > mCapParams.minFramesNum, "maxFramesNum < minFramesNum") &&
             checkAssertion(mInternalParameters.solverEps > 0, "Solver precision must be positive") &&
             checkAssertion(mInternalParameters.solverMaxIters > 0, "Max solver iterations number must be positive") &&
+            checkAssertion(mInternalParameters.coverageGridSize > 0, "Coverage grid size must be positive") &&
+            checkAssertion(mInternalParameters.robustLoss >= 0 && mInternalParameters.robustLoss <= 2,
+                           "Robust loss must be 0 (none), 1 (Huber) or 2 (Cauchy)") &&
+            checkAssertion(mInternalParameters.robustLossScale > 0, "Robust loss scale must be positive") &&
             checkAssertion(mInternalParameters.filterAlpha >=0 && mInternalParameters.filterAlpha <=1 ,
                            "Frame filter convolution parameter must be in [0,1] interval") &&
             checkAssertion(mCapParams.cameraResolution.width > 0 && mCapParams.cameraResolution.height > 0,
@@ -87,6 +105,12 @@ bool calib::parametersController::loadFromParser(cv::CommandLineParser &parser)
     if(!checkAssertion(mCapParams.templDst > 0, "Distance betwen parts of dual template must be positive"))
         return false;
 
+    mCapParams.captureMethod = InputType::Video;
+    if (parser.has("b")) {
+        mCapParams.captureMethod = InputType::Pictures;
+        mCapParams.imagesPattern = parser.get<std::string>("b");
+    }
+
     if (parser.has("v")) {
         mCapParams.source = InputVideoSource::File;
         mCapParams.videoFileName = parser.get<std::string>("v");
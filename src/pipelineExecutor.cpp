@@ -0,0 +1,119 @@
+#include "pipelineExecutor.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+
+using namespace calib;
+
+OrderedFrameQueue::OrderedFrameQueue()
+{
+    mNextIndex = 0;
+    mIsClosed = false;
+}
+
+void OrderedFrameQueue::push(size_t index, const cv::Mat &frame)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFrames[index] = frame;
+    mCondition.notify_all();
+}
+
+bool OrderedFrameQueue::pop(size_t &index, cv::Mat &frame, bool wait)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto isNextReady = [this] { return !mFrames.empty() && mFrames.begin()->first == mNextIndex; };
+    if(wait)
+        mCondition.wait(lock, [this, &isNextReady] { return mIsClosed || isNextReady(); });
+    if(mIsClosed || !isNextReady())
+        return false;
+
+    auto it = mFrames.begin();
+    index = it->first;
+    frame = it->second;
+    mFrames.erase(it);
+    mNextIndex++;
+    return true;
+}
+
+void OrderedFrameQueue::close()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIsClosed = true;
+    mCondition.notify_all();
+}
+
+PipelineExecutor::PipelineExecutor(const std::vector<Sptr<FrameProcessor>> &processors, unsigned statelessWorkers,
+                                   size_t maxFramesInFlight, size_t firstFrameNumber) :
+    mProcessors(processors), mFirstFrameNumber(firstFrameNumber)
+{
+    mMaxFramesInFlight = std::max(maxFramesInFlight, (size_t)1);
+    mFramesInFlight = 0;
+    mSubmittedFrames = 0;
+
+    for(size_t i = 0; i <= mProcessors.size(); i++)
+        mQueues.push_back(Sptr<OrderedFrameQueue>(new OrderedFrameQueue));
+
+    for(size_t i = 0; i < mProcessors.size(); i++) {
+        unsigned workersNum = mProcessors[i]->isStateless() ? std::max(statelessWorkers, 1u) : 1u;
+        for(unsigned j = 0; j < workersNum; j++)
+            mWorkers.push_back(std::thread(&PipelineExecutor::runStage, this, i));
+    }
+}
+
+PipelineExecutor::~PipelineExecutor()
+{
+    for(auto it = mQueues.begin(); it != mQueues.end(); ++it)
+        (*it)->close();
+    for(auto it = mWorkers.begin(); it != mWorkers.end(); ++it)
+        it->join();
+}
+
+void PipelineExecutor::runStage(size_t stage)
+{
+    size_t index;
+    cv::Mat frame;
+    while(mQueues[stage]->pop(index, frame)) {
+        Profiler::setCurrentFrame((long long)(mFirstFrameNumber + index));
+        frame = mProcessors[stage]->processFrame(frame);
+        mQueues[stage + 1]->push(index, frame);
+    }
+}
+
+bool PipelineExecutor::trySubmit(const cv::Mat &frame)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mFramesInFlight >= mMaxFramesInFlight)
+        return false;
+    mFramesInFlight++;
+    mQueues.front()->push(mSubmittedFrames++, frame);
+    return true;
+}
+
+bool PipelineExecutor::getResult(cv::Mat &frame, bool wait)
+{
+    size_t index;
+    if(!mQueues.back()->pop(index, frame, wait))
+        return false;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFramesInFlight--;
+    Profiler::instance().addCount(ProfileCounter::ProcessedFrames);
+    return true;
+}
+
+void PipelineExecutor::drain()
+{
+    cv::Mat frame;
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(mFramesInFlight == 0)
+                break;
+        }
+        getResult(frame, true);
+    }
+}
+
+size_t PipelineExecutor::getSubmittedFramesNum() const
+{
+    return mSubmittedFrames;
+}
@@ -0,0 +1,177 @@
+#include "pointStore.hpp"
+
+#include <algorithm>
+
+using namespace calib;
+
+PointStore::PointStore()
+{
+    mLivePointsNum = 0;
+    mRevision = 0;
+}
+
+void PointStore::compact()
+{
+    size_t dst = 0;
+    for(auto& view : mViews) {
+        if(view.offset != dst) {
+            std::copy(mImagePoints.begin() + view.offset, mImagePoints.begin() + view.offset + view.pointsNum,
+                      mImagePoints.begin() + dst);
+            std::copy(mPointIds.begin() + view.offset, mPointIds.begin() + view.offset + view.pointsNum,
+                      mPointIds.begin() + dst);
+            view.offset = dst;
+        }
+        dst += view.pointsNum;
+    }
+    mImagePoints.resize(dst);
+    mPointIds.resize(dst);
+}
+
+void PointStore::trimTail()
+{
+    size_t end = mViews.empty() ? 0 : mViews.back().offset + mViews.back().pointsNum;
+    mImagePoints.resize(end);
+    mPointIds.resize(end);
+}
+
+void PointStore::setBoardModel(std::shared_ptr<const BoardModel> board)
+{
+    clear();
+    mBoard = board;
+}
+
+std::shared_ptr<const BoardModel> PointStore::getBoardModel() const
+{
+    return mBoard;
+}
+
+void PointStore::addView(cv::InputArray imagePoints)
+{
+    CV_Assert(mBoard);
+    cv::Mat imgPt = imagePoints.getMat();
+    int pointsNum = imgPt.checkVector(2, CV_32F);
+    CV_Assert(pointsNum == (int)mBoard->getPointsNumber());
+
+    viewRecord view;
+    view.offset = mImagePoints.size();
+    view.pointsNum = pointsNum;
+    mImagePoints.insert(mImagePoints.end(), imgPt.ptr<cv::Point2f>(), imgPt.ptr<cv::Point2f>() + pointsNum);
+    for(int i = 0; i < pointsNum; i++)
+        mPointIds.push_back(i);
+    mViews.push_back(view);
+    mLivePointsNum += pointsNum;
+    mRevision++;
+}
+
+void PointStore::addView(cv::InputArray imagePoints, cv::InputArray pointIds)
+{
+    CV_Assert(mBoard);
+    cv::Mat imgPt = imagePoints.getMat(), ids = pointIds.getMat();
+    int pointsNum = imgPt.checkVector(2, CV_32F);
+    CV_Assert(pointsNum >= 0 && ids.checkVector(1, CV_32S) == pointsNum);
+
+    const int* idsPtr = ids.ptr<int>();
+    for(int i = 0; i < pointsNum; i++)
+        CV_Assert(idsPtr[i] >= 0 && idsPtr[i] < (int)mBoard->getPointsNumber());
+
+    viewRecord view;
+    view.offset = mImagePoints.size();
+    view.pointsNum = pointsNum;
+    mImagePoints.insert(mImagePoints.end(), imgPt.ptr<cv::Point2f>(), imgPt.ptr<cv::Point2f>() + pointsNum);
+    mPointIds.insert(mPointIds.end(), idsPtr, idsPtr + pointsNum);
+    mViews.push_back(view);
+    mLivePointsNum += pointsNum;
+    mRevision++;
+}
+
+void PointStore::removeView(size_t index)
+{
+    CV_Assert(index < mViews.size());
+    mLivePointsNum -= mViews[index].pointsNum;
+    mViews.erase(mViews.begin() + index);
+    mRevision++;
+
+    if(index == mViews.size())
+        trimTail();
+    else if(mImagePoints.size() > 2*mLivePointsNum)
+        compact();
+}
+
+void PointStore::removeLastView()
+{
+    if(!mViews.empty())
+        removeView(mViews.size() - 1);
+}
+
+void PointStore::clear()
+{
+    mImagePoints.clear();
+    mPointIds.clear();
+    mViews.clear();
+    mLivePointsNum = 0;
+    mRevision++;
+}
+
+bool PointStore::empty() const
+{
+    return mViews.empty();
+}
+
+size_t PointStore::getViewsNumber() const
+{
+    return mViews.size();
+}
+
+size_t PointStore::getTotalPointsNumber() const
+{
+    return mLivePointsNum;
+}
+
+int PointStore::getPointsNumber(size_t index) const
+{
+    return mViews[index].pointsNum;
+}
+
+unsigned long long PointStore::getRevision() const
+{
+    return mRevision;
+}
+
+const cv::Point2f* PointStore::getImagePoints(size_t index) const
+{
+    return mImagePoints.data() + mViews[index].offset;
+}
+
+const int* PointStore::getPointIds(size_t index) const
+{
+    return mPointIds.data() + mViews[index].offset;
+}
+
+cv::Mat PointStore::getImagePointsMat(size_t index) const
+{
+    return cv::Mat(1, mViews[index].pointsNum, CV_32FC2, (void*)getImagePoints(index));
+}
+
+void PointStore::getObjectPoints(size_t index, std::vector<cv::Point3f> &objectPoints) const
+{
+    const int* ids = mPointIds.data() + mViews[index].offset;
+    objectPoints.resize(mViews[index].pointsNum);
+    for(int i = 0; i < mViews[index].pointsNum; i++)
+        objectPoints[i] = mBoard->getPoint(ids[i]);
+}
+
+void PointStore::getPacked(cv::Mat &objectPoints, cv::Mat &imagePoints, cv::Mat &npoints)
+{
+    if(mImagePoints.size() != mLivePointsNum)
+        compact();
+
+    mPackedObjectPoints.resize(mPointIds.size());
+    for(size_t i = 0; i < mPointIds.size(); i++)
+        mPackedObjectPoints[i] = mBoard->getPoint(mPointIds[i]);
+
+    objectPoints = cv::Mat(1, (int)mPackedObjectPoints.size(), CV_32FC3, (void*)mPackedObjectPoints.data());
+    imagePoints = cv::Mat(1, (int)mImagePoints.size(), CV_32FC2, (void*)mImagePoints.data());
+    npoints.create(1, (int)mViews.size(), CV_32S);
+    for(size_t i = 0; i < mViews.size(); i++)
+        npoints.at<int>((int)i) = mViews[i].pointsNum;
+}
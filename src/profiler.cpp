@@ -0,0 +1,288 @@
+#include "profiler.hpp"
+#include "cvCalibrationFork.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+using namespace calib;
+
+// the trace events of a thread are moved to the session trace in batches of that size
+#define TRACE_FLUSH_EVENTS 256
+// about 40 MB of events, the following ones are only counted
+#define TRACE_MAX_EVENTS (1 << 20)
+
+static const char* stageNames[] = { "capture", "flip", "grayscale", "precheck", "detect_chessboard", "detect_charuco", "detect_acircles",
+                                    "detect_dual_acircles", "corner_subpix", "pose_check", "remap", "drawing", "downscale",
+                                    "solver_jacobian", "solver_error", "solver_step", "calibration",
+                                    "undistort_map", "filter_frames" };
+
+static const char* counterNames[] = { "grabbed_frames", "processed_frames", "solver_iterations",
+                                      "jacobian_evaluations" };
+
+enum class stageGroup { None, Camera, Detector, Display, Solver };
+
+// nested stages are not added to the group totals
+static const stageGroup stageGroups[] = { stageGroup::Camera, stageGroup::Camera, stageGroup::Detector, stageGroup::Detector,
+                                          stageGroup::Detector,
+                                          stageGroup::Detector, stageGroup::Detector, stageGroup::Detector,
+                                          stageGroup::None, stageGroup::Detector, stageGroup::Display,
+                                          stageGroup::Display, stageGroup::Display, stageGroup::None,
+                                          stageGroup::None, stageGroup::None, stageGroup::Solver, stageGroup::None,
+                                          stageGroup::None };
+
+static thread_local long long currentFrame = -1;
+
+static unsigned getThreadNumber()
+{
+    static std::atomic<unsigned> threadsCount(0);
+    static thread_local unsigned threadNumber = threadsCount++;
+    return threadNumber;
+}
+
+static void addSolverSample(cvfork::SolverStage stage, Profiler::clock::time_point startPoint,
+                            Profiler::clock::time_point endPoint)
+{
+    const ProfileStage stages[] = { ProfileStage::SolverStep, ProfileStage::SolverJacobian, ProfileStage::SolverError };
+    Profiler::instance().addSample(stages[stage], startPoint, endPoint);
+}
+
+static void addSolverCount(cvfork::SolverCounter counter, long long value)
+{
+    const ProfileCounter counters[] = { ProfileCounter::SolverIterations, ProfileCounter::JacobianEvaluations };
+    Profiler::instance().addCount(counters[counter], value);
+}
+
+Profiler::Profiler() :
+    mStats((size_t)ProfileStage::StagesNum)
+{
+    mIsEnabled = false;
+    mIsTracing = false;
+    mStartPoint = clock::now();
+    for(auto& counter : mCounters)
+        counter = 0;
+    mDroppedEvents = 0;
+}
+
+void Profiler::mergeStats(stageStats &dst, const stageStats &src)
+{
+    dst.count += src.count;
+    dst.total += src.total;
+    dst.max = std::max(dst.max, src.max);
+}
+
+// merges the buffer into the session data when its thread finishes
+struct Profiler::threadBufferHolder
+{
+    std::shared_ptr<threadBuffer> buffer;
+
+    ~threadBufferHolder()
+    {
+        if(buffer)
+            Profiler::instance().releaseThreadBuffer(buffer);
+    }
+};
+
+Profiler::threadBuffer &Profiler::getThreadBuffer()
+{
+    static thread_local threadBufferHolder holder;
+    if(!holder.buffer) {
+        holder.buffer = std::make_shared<threadBuffer>();
+        holder.buffer->stats.resize((size_t)ProfileStage::StagesNum);
+        holder.buffer->trace.reserve(TRACE_FLUSH_EVENTS);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBuffers.push_back(holder.buffer);
+    }
+    return *holder.buffer;
+}
+
+void Profiler::releaseThreadBuffer(const std::shared_ptr<threadBuffer> &buffer)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        for(size_t i = 0; i < mStats.size(); i++)
+            mergeStats(mStats[i], buffer->stats[i]);
+        appendTrace(buffer->trace);
+        buffer->trace.clear();
+    }
+    mBuffers.erase(std::remove(mBuffers.begin(), mBuffers.end(), buffer), mBuffers.end());
+}
+
+void Profiler::appendTrace(const std::vector<traceEvent> &events)
+{
+    size_t room = TRACE_MAX_EVENTS - std::min(mTrace.size(), (size_t)TRACE_MAX_EVENTS);
+    size_t appended = std::min(room, events.size());
+    mTrace.insert(mTrace.end(), events.begin(), events.begin() + appended);
+    mDroppedEvents += events.size() - appended;
+}
+
+void Profiler::collectStats(std::vector<stageStats> &stats) const
+{
+    stats = mStats;
+    for(auto& buffer : mBuffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        for(size_t i = 0; i < stats.size(); i++)
+            mergeStats(stats[i], buffer->stats[i]);
+    }
+}
+
+Profiler &Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+const char *Profiler::getStageName(ProfileStage stage)
+{
+    return stageNames[(int)stage];
+}
+
+void Profiler::setCurrentFrame(long long frame)
+{
+    currentFrame = frame;
+}
+
+void Profiler::enable(bool withTrace)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIsTracing = withTrace;
+    mStartPoint = clock::now();
+    mIsEnabled = true;
+    cvfork::setSolverHooks(addSolverSample, addSolverCount);
+}
+
+bool Profiler::isEnabled() const
+{
+    // acquire pairs with enable(), so the samples see its start point
+    return mIsEnabled.load(std::memory_order_acquire);
+}
+
+void Profiler::addSample(ProfileStage stage, clock::time_point startPoint, clock::time_point endPoint)
+{
+    double duration = std::chrono::duration<double>(endPoint - startPoint).count();
+    threadBuffer& buffer = getThreadBuffer();
+    std::vector<traceEvent> events;
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer.mutex);
+        stageStats& stats = buffer.stats[(size_t)stage];
+        stats.count++;
+        stats.total += duration;
+        stats.max = std::max(stats.max, duration);
+
+        if(mIsTracing.load(std::memory_order_relaxed)) {
+            traceEvent event;
+            event.frame = currentFrame;
+            event.stage = (int)stage;
+            event.thread = getThreadNumber();
+            event.start = std::chrono::duration<double>(startPoint - mStartPoint).count();
+            event.duration = duration;
+            buffer.trace.push_back(event);
+            if(buffer.trace.size() >= TRACE_FLUSH_EVENTS) {
+                events.swap(buffer.trace);
+                buffer.trace.reserve(TRACE_FLUSH_EVENTS);
+            }
+        }
+    }
+    // the readers lock the session data first, so the buffer is not locked here
+    if(!events.empty()) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        appendTrace(events);
+    }
+}
+
+void Profiler::addCount(ProfileCounter counter, long long value)
+{
+    if(!isEnabled())
+        return;
+    mCounters[(size_t)counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Profiler::printSummary(std::ostream &output) const
+{
+    std::vector<stageStats> allStats;
+    std::lock_guard<std::mutex> lock(mMutex);
+    collectStats(allStats);
+    const char* border = "---------------------------------------------------";
+    output << border << std::endl << "Profiling summary" << std::endl;
+    output << std::left << std::setw(24) << "stage" << std::right << std::setw(10) << "calls"
+           << std::setw(12) << "total, s" << std::setw(12) << "mean, ms" << std::setw(12) << "max, ms" << std::endl;
+
+    double groupTotals[5] = {0};
+    for(size_t i = 0; i < allStats.size(); i++) {
+        const stageStats& stats = allStats[i];
+        groupTotals[(int)stageGroups[i]] += stats.total;
+        if(!stats.count)
+            continue;
+        output << std::left << std::setw(24) << stageNames[i] << std::right << std::setw(10) << stats.count
+               << std::fixed << std::setprecision(3) << std::setw(12) << stats.total
+               << std::setw(12) << 1e3*stats.total / stats.count << std::setw(12) << 1e3*stats.max << std::endl;
+    }
+    for(size_t i = 0; i < (size_t)ProfileCounter::CountersNum; i++)
+        output << std::left << std::setw(24) << counterNames[i] << std::right << std::setw(10) << mCounters[i].load()
+               << std::endl;
+    if(mDroppedEvents)
+        output << "Trace events over the limit: " << mDroppedEvents << std::endl;
+
+    long long framesNum = std::max(mCounters[(size_t)ProfileCounter::ProcessedFrames].load(), 1LL);
+    output << "Per processed frame, ms: camera " << 1e3*groupTotals[(int)stageGroup::Camera] / framesNum
+           << ", detector " << 1e3*groupTotals[(int)stageGroup::Detector] / framesNum
+           << ", display " << 1e3*groupTotals[(int)stageGroup::Display] / framesNum << std::endl;
+    output << "Solver (background), s: " << groupTotals[(int)stageGroup::Solver] << std::endl;
+    output.unsetf(std::ios_base::floatfield);
+}
+
+bool Profiler::writeTrace(const std::string &fileName) const
+{
+    std::ofstream output(fileName);
+    if(!output.is_open())
+        return false;
+
+    std::vector<traceEvent> trace;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        trace = mTrace;
+        for(auto& buffer : mBuffers) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            trace.insert(trace.end(), buffer->trace.begin(), buffer->trace.end());
+        }
+    }
+    // the threads flush their events in batches, so the trace is put in time order here
+    std::stable_sort(trace.begin(), trace.end(), [](const traceEvent& a, const traceEvent& b) {
+        return a.start < b.start;
+    });
+
+    bool isJson = fileName.size() > 5 && fileName.compare(fileName.size() - 5, 5, ".json") == 0;
+    output << std::fixed << std::setprecision(6);
+    if(isJson) {
+        output << "{\"traceEvents\":[" << std::endl;
+        for(size_t i = 0; i < trace.size(); i++) {
+            const traceEvent& event = trace[i];
+            output << "{\"name\":\"" << stageNames[event.stage] << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+                   << ",\"ts\":" << 1e6*event.start << ",\"dur\":" << 1e6*event.duration
+                   << ",\"args\":{\"frame\":" << event.frame << "}}" << (i + 1 < trace.size() ? "," : "") << std::endl;
+        }
+        output << "]}" << std::endl;
+    }
+    else {
+        output << "frame,thread,stage,start_s,duration_s" << std::endl;
+        for(auto& event : trace)
+            output << event.frame << "," << event.thread << "," << stageNames[event.stage] << ","
+                   << event.start << "," << event.duration << std::endl;
+    }
+    return true;
+}
+
+ScopedTimer::ScopedTimer(ProfileStage stage) :
+    mStage(stage)
+{
+    mIsActive = Profiler::instance().isEnabled();
+    if(mIsActive)
+        mStartPoint = Profiler::clock::now();
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    if(mIsActive)
+        Profiler::instance().addSample(mStage, mStartPoint, Profiler::clock::now());
+}
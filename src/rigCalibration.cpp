@@ -0,0 +1,363 @@
+#include "rigCalibration.hpp"
+#include "cvCalibrationFork.hpp"
+#include "display.hpp"
+#include "framePool.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace calib;
+
+#define IDLE_DELAY 5
+#define FRAMES_RING_SIZE 2
+#define CONCURRENT_SOLVES 1
+
+RigCalibration::RigCalibration(const captureParameters &params, const internalParameters &intParams,
+                               int calibFlags, bool autoTuning, cv::TermCriteria termCrit,
+                               const std::string &outputFileName) :
+    mCaptureParams(params), mInternalParams(intParams), mTermCrit(termCrit), mOutputFileName(outputFileName)
+{
+    mCalibFlags = calibFlags;
+    mAutoTuning = autoTuning;
+    mStop = false;
+    mActiveCaptures = 0;
+    mProcessedFrames = 0;
+    mNextSession = 0;
+}
+
+RigCalibration::~RigCalibration()
+{
+    stop();
+}
+
+std::string RigCalibration::getCameraFileName(const std::string &fileName, int camID)
+{
+    size_t dotPos = fileName.find_last_of('.');
+    size_t slashPos = fileName.find_last_of("/\\");
+    if(dotPos == std::string::npos || (slashPos != std::string::npos && dotPos < slashPos))
+        dotPos = fileName.size();
+    return fileName.substr(0, dotPos) + "_cam" + std::to_string(camID) + fileName.substr(dotPos);
+}
+
+void RigCalibration::openSession(int camID)
+{
+    Sptr<cameraSession> session(new cameraSession);
+    session->params = mCaptureParams;
+    session->params.source = InputVideoSource::Camera;
+    session->params.camID = camID;
+    CalibPipeline::openVideoCapture(session->capture, session->params);
+    session->imageSize = cv::Size((int)session->capture.get(cv::CAP_PROP_FRAME_WIDTH),
+                                  (int)session->capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+    // overlay messages are shown in the main window, it belongs to the first camera
+    session->windowName = mSessions.empty() ? mainWindowName :
+                                              mainWindowName + " " + std::to_string(camID);
+    session->frames = Sptr<FrameRingBuffer>(new FrameRingBuffer(FRAMES_RING_SIZE, FrameDropPolicy::DropOldest));
+
+    session->data = Sptr<calibrationData>(new calibrationData);
+    session->data->imageSize = session->imageSize;
+    session->data->coverage.setGridSize(mInternalParams.coverageGridSize);
+    session->controller = Sptr<calibController>(new calibController(session->data, mCalibFlags, mAutoTuning,
+                                                                    session->params.minFramesNum));
+    session->controller->setParallelTuning(mInternalParams.parallelTuning);
+    session->dataController = Sptr<calibDataController>(new calibDataController(session->data,
+                                                                                session->params.maxFramesNum,
+                                                                                mInternalParams.filterAlpha));
+    session->dataController->setParametersFileName(getCameraFileName(mOutputFileName, camID));
+    session->dataController->setPreviewWidth(session->params.previewWidth);
+
+    session->calibProcessor = Sptr<CalibProcessor>(new CalibProcessor(session->data, session->params));
+    session->showProcessor = Sptr<ShowProcessor>(new ShowProcessor(session->data, session->controller,
+                                                                   session->params.board));
+    session->showProcessor->setPreviewWidth(session->params.previewWidth);
+    session->worker = Sptr<CalibWorker>(new CalibWorker(mTermCrit, mInternalParams.robustLossScale));
+
+    mSessions.push_back(session);
+}
+
+void RigCalibration::captureFrames(cameraSession &session)
+{
+    cv::Mat frame;
+    long long grabbedFrames = 0;
+    while(!mStop) {
+        Profiler::setCurrentFrame(grabbedFrames++);
+        {
+            ScopedTimer timer(ProfileStage::Capture);
+            if(!session.capture.grab())
+                break;
+            if(FramePool::isShared(frame))
+                frame.release();
+            session.capture.retrieve(frame);
+        }
+        Profiler::instance().addCount(ProfileCounter::GrabbedFrames);
+        if(session.params.flipVertical) {
+            ScopedTimer timer(ProfileStage::Flip);
+            cv::flip(frame, frame, -1);
+        }
+        if(!session.frames->push(frame))
+            break;
+        // the detection threads check the buffers under mMutex, so no wake up is lost
+        { std::lock_guard<std::mutex> lock(mMutex); }
+        mCondition.notify_all();
+    }
+    session.frames->close();
+    mActiveCaptures--;
+}
+
+RigCalibration::cameraSession* RigCalibration::findReadySession(cv::Mat &frame)
+{
+    for(size_t i = 0; i < mSessions.size(); i++) {
+        size_t index = (mNextSession + i) % mSessions.size();
+        cameraSession& session = *mSessions[index];
+        if(!session.isBusy && session.frames->pop(frame, false)) {
+            mNextSession = index + 1;
+            return &session;
+        }
+    }
+    return 0;
+}
+
+void RigCalibration::detectFrames()
+{
+    cv::Mat frame;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true) {
+        cameraSession* session = 0;
+        mCondition.wait(lock, [&] { return mStop || (session = findReadySession(frame)) != 0; });
+        if(mStop)
+            break;
+
+        session->isBusy = true;
+        lock.unlock();
+
+        Profiler::setCurrentFrame(mProcessedFrames++);
+        Profiler::instance().addCount(ProfileCounter::ProcessedFrames);
+        cv::Mat processedFrame = session->calibProcessor->processFrame(frame);
+        processedFrame = session->showProcessor->processFrame(processedFrame);
+        bool isProcessed = session->calibProcessor->isProcessed();
+        if(isProcessed)
+            session->calibProcessor->resetState();
+
+        lock.lock();
+        session->displayFrame = processedFrame;
+        session->isBusy = false;
+        if(isProcessed)
+            session->isCalibrationPending = true;
+        mCondition.notify_all();
+    }
+}
+
+void RigCalibration::acquireSession(cameraSession &session)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [&] { return !session.isBusy; });
+    session.isBusy = true;
+}
+
+void RigCalibration::releaseSession(cameraSession &session)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        session.isBusy = false;
+    }
+    mCondition.notify_all();
+}
+
+void RigCalibration::applyResult(cameraSession &session)
+{
+    calibrationResult result;
+    if(!session.worker->fetchResult(result))
+        return;
+    if(!result.errorMessage.empty()) {
+        std::cout << "Camera " << session.params.camID << ": " << result.errorMessage << std::endl;
+        return;
+    }
+
+    acquireSession(session);
+    Sptr<calibrationData> data = session.data;
+    bool needsCalibration = false;
+    if(result.removalsCount == data->removalsCount) {
+        data->cameraMatrix = result.cameraMatrix;
+        data->distCoeffs = result.distCoeffs;
+        data->stdDeviations = result.stdDeviations;
+        data->perViewErrors = result.perViewErrors;
+        data->rvecs = result.rvecs;
+        data->tvecs = result.tvecs;
+        data->totalAvgErr = result.totalAvgErr;
+
+        session.dataController->updateUndistortMap();
+        std::cout << "Camera " << session.params.camID << "\n";
+        session.dataController->printParametersToConsole(std::cout);
+        std::cout << "Calibration time: " << result.calibrationTime << "\n";
+        if(result.isTuned)
+            session.controller->setTunedFlags(result.flags);
+        session.controller->updateState();
+        if(data->points.getViewsNumber() == result.framesNum)
+            for(int j = 0; j < session.params.calibrationStep; j++)
+                session.dataController->filterFrames();
+        else
+            needsCalibration = true;
+        session.showProcessor->updateBoardsView();
+    }
+    // frames were deleted while solving, the result is stale and the rest is solved again
+    else if(data->points.getViewsNumber() >= (size_t)session.params.minFramesNum)
+        needsCalibration = true;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        session.isCalibrationPending |= needsCalibration;
+    }
+    releaseSession(session);
+}
+
+void RigCalibration::scheduleCalibrations()
+{
+    int runningSolves = 0;
+    for(auto& session : mSessions)
+        runningSolves += session->worker->isBusy() ? 1 : 0;
+
+    while(runningSolves < CONCURRENT_SOLVES) {
+        // the camera with most unmet quality criteria is solved first, then the one with fewer views
+        cameraSession* next = 0;
+        int nextUnmetCriteria = -1;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(auto& session : mSessions) {
+                if(!session->isCalibrationPending || session->isBusy || session->worker->isBusy())
+                    continue;
+                int unmetCriteria = session->controller->getUnmetCriteriaNumber();
+                if(unmetCriteria > nextUnmetCriteria || (unmetCriteria == nextUnmetCriteria &&
+                        session->data->points.getViewsNumber() < next->data->points.getViewsNumber())) {
+                    next = session.get();
+                    nextUnmetCriteria = unmetCriteria;
+                }
+            }
+            if(!next)
+                return;
+            next->isBusy = true;
+        }
+
+        Sptr<calibrationData> data = next->data;
+        next->dataController->rememberCurrentParameters();
+        data->imageSize = next->imageSize;
+        int flags = next->controller->getNewFlags();
+        if(mInternalParams.incrementalSolving && data->cameraMatrix.total())
+            flags |= cv::CALIB_USE_INTRINSIC_GUESS | CALIB_USE_INITIAL_EXTRINSICS;
+        bool isRequested = next->worker->requestCalibration(*data, flags, next->controller->getCandidateFlags());
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            next->isCalibrationPending = !isRequested;
+        }
+        releaseSession(*next);
+        if(!isRequested)
+            return;
+        runningSolves++;
+    }
+}
+
+void RigCalibration::processKey(PipelineExitStatus status)
+{
+    if(status == PipelineExitStatus::Continue || status == PipelineExitStatus::SwitchVisualisation)
+        return;
+
+    for(auto& session : mSessions) {
+        acquireSession(*session);
+        if(status == PipelineExitStatus::DeleteLastFrame) {
+            session->dataController->deleteLastFrame();
+            session->showProcessor->updateBoardsView();
+        }
+        else if(status == PipelineExitStatus::DeleteAllFrames) {
+            session->dataController->deleteAllData();
+            session->showProcessor->updateBoardsView();
+        }
+        else if(status == PipelineExitStatus::SaveCurrentData) {
+            if(session->dataController->saveCurrentCameraParameters())
+                std::cout << "Camera " << session->params.camID << " parameters saved" << std::endl;
+        }
+        else if(status == PipelineExitStatus::SwitchUndistort)
+            session->showProcessor->switchUndistort();
+        else if(status == PipelineExitStatus::EnableUndistort || status == PipelineExitStatus::DisableUndistort)
+            session->showProcessor->setUndistort(status == PipelineExitStatus::EnableUndistort);
+        releaseSession(*session);
+    }
+}
+
+void RigCalibration::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    for(auto& session : mSessions)
+        session->frames->close();
+    for(auto& session : mSessions)
+        if(session->captureThread.joinable())
+            session->captureThread.join();
+    for(auto& thread : mDetectionThreads)
+        thread.join();
+    mDetectionThreads.clear();
+    for(auto& session : mSessions)
+        session->worker->cancel();
+}
+
+bool RigCalibration::run(const std::vector<int> &cameraIds)
+{
+    for(int camID : cameraIds)
+        openSession(camID);
+    if(mSessions.empty())
+        return false;
+
+    for(size_t i = 0; i < mSessions.size(); i++) {
+        Display::instance().createWindow(mSessions[i]->windowName, cv::Point(10 + 40*(int)i, 10 + 40*(int)i));
+    }
+
+    mStop = false;
+    mActiveCaptures = (int)mSessions.size();
+    for(auto& session : mSessions)
+        session->captureThread = std::thread(&RigCalibration::captureFrames, this, std::ref(*session));
+    int threadsNum = mCaptureParams.processingThreads > 0 ? mCaptureParams.processingThreads :
+                                                            (int)std::max(std::thread::hardware_concurrency(), 1u);
+    for(int i = 0; i < threadsNum; i++)
+        mDetectionThreads.push_back(std::thread(&RigCalibration::detectFrames, this));
+
+    cv::Mat frame;
+    while(mActiveCaptures > 0) {
+        for(auto& session : mSessions) {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                frame = session->displayFrame;
+                session->displayFrame.release();
+            }
+            if(!frame.empty())
+                Display::instance().show(session->windowName, frame);
+            frame.release();
+        }
+
+        PipelineExitStatus status = CalibPipeline::getKeyStatus(Display::instance().pollKey());
+        if(status == PipelineExitStatus::Finished)
+            break;
+        processKey(status);
+
+        for(auto& session : mSessions)
+            if(session->worker->isResultReady())
+                applyResult(*session);
+        scheduleCalibrations();
+        // the detection threads do the work, this loop only forwards frames and results
+        std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_DELAY));
+    }
+    stop();
+
+    bool isCalibrated = true;
+    for(auto& session : mSessions) {
+        if(session->controller->getCommonCalibrationState()) {
+            if(session->dataController->saveCurrentCameraParameters())
+                std::cout << "Camera " << session->params.camID << " parameters saved" << std::endl;
+        }
+        else {
+            std::cout << "Camera " << session->params.camID << " is not calibrated" << std::endl;
+            isCalibrated = false;
+        }
+    }
+    return isCalibrated;
+}
@@ -0,0 +1,265 @@
+#include "sessionJournal.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JOURNAL_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace calib;
+
+#define JOURNAL_MAGIC "CALIBJNL"
+#define JOURNAL_VERSION 1
+
+namespace
+{
+enum recordType { AddView = 1, RemoveView = 2, ClearViews = 3 };
+
+struct journalHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t imageWidth;
+    int32_t imageHeight;
+    uint32_t boardPointsNum;
+    uint64_t boardHash;
+};
+
+// followed by pointsNum image points and pointsNum ids for AddView
+struct journalRecord
+{
+    uint32_t type;
+    int32_t pointsNum;
+    uint64_t index;
+    int64_t timestamp;
+};
+
+// read-only view of a whole file
+class mappedFile
+{
+    const char* data;
+    size_t size;
+    std::vector<char> buffer;
+#ifdef JOURNAL_USE_MMAP
+    void* mapping;
+#endif
+public:
+    mappedFile() : data(0), size(0)
+#ifdef JOURNAL_USE_MMAP
+      , mapping(0)
+#endif
+    {}
+
+    bool open(const std::string& fileName)
+    {
+#ifdef JOURNAL_USE_MMAP
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if(fd >= 0) {
+            struct stat fileStat;
+            if(fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+                void* ptr = mmap(0, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(ptr != MAP_FAILED) {
+                    mapping = ptr;
+                    data = (const char*)ptr;
+                    size = (size_t)fileStat.st_size;
+                }
+            }
+            ::close(fd);
+            if(data)
+                return true;
+        }
+#endif
+        std::ifstream stream(fileName, std::ios::binary);
+        if(!stream.is_open())
+            return false;
+        buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+    }
+
+    ~mappedFile()
+    {
+#ifdef JOURNAL_USE_MMAP
+        if(mapping)
+            munmap(mapping, size);
+#endif
+    }
+
+    const char* getData() const { return data; }
+    size_t getSize() const { return size; }
+};
+}
+
+SessionJournal::SessionJournal()
+{
+
+}
+
+SessionJournal::~SessionJournal()
+{
+    close();
+}
+
+uint64 SessionJournal::getBoardHash(const BoardModel &board)
+{
+    // FNV-1a over the object points
+    const std::vector<cv::Point3f>& points = board.getPoints();
+    const unsigned char* bytes = (const unsigned char*)points.data();
+    uint64 hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < points.size()*sizeof(cv::Point3f); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool SessionJournal::open(const std::string &fileName, const PointStore &points, cv::Size imageSize)
+{
+    close();
+    CV_Assert(points.getBoardModel());
+    const BoardModel& board = *points.getBoardModel();
+
+    // the snapshot is written aside and then replaces the old journal, so a crash keeps one of them
+    std::string tmpFileName = fileName + ".tmp";
+    mStream.open(tmpFileName, std::ios::binary | std::ios::trunc);
+    if(!mStream.is_open())
+        return false;
+
+    journalHeader header;
+    std::memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.imageWidth = imageSize.width;
+    header.imageHeight = imageSize.height;
+    header.boardPointsNum = (uint32_t)board.getPointsNumber();
+    header.boardHash = getBoardHash(board);
+    mStream.write((const char*)&header, sizeof(header));
+    mStream.write((const char*)board.getPoints().data(), board.getPointsNumber()*sizeof(cv::Point3f));
+    for(size_t i = 0; i < points.getViewsNumber(); i++)
+        addView(points, i);
+    mStream.close();
+
+    std::remove(fileName.c_str());
+    if(std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+        return false;
+    mStream.open(fileName, std::ios::binary | std::ios::app);
+    return mStream.is_open();
+}
+
+bool SessionJournal::isOpened() const
+{
+    return mStream.is_open();
+}
+
+void SessionJournal::close()
+{
+    if(mStream.is_open())
+        mStream.close();
+}
+
+void SessionJournal::writeRecord(unsigned type, size_t index, int pointsNum, const cv::Point2f *points, const int *ids)
+{
+    if(!mStream.is_open())
+        return;
+
+    using namespace std::chrono;
+    journalRecord record;
+    record.type = type;
+    record.pointsNum = pointsNum;
+    record.index = index;
+    record.timestamp = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    mStream.write((const char*)&record, sizeof(record));
+    if(pointsNum > 0) {
+        mStream.write((const char*)points, pointsNum*sizeof(cv::Point2f));
+        mStream.write((const char*)ids, pointsNum*sizeof(int));
+    }
+    mStream.flush();
+}
+
+void SessionJournal::addView(const PointStore &points, size_t index)
+{
+    writeRecord(AddView, index, points.getPointsNumber(index), points.getImagePoints(index), points.getPointIds(index));
+}
+
+void SessionJournal::removeView(size_t index)
+{
+    writeRecord(RemoveView, index, 0, 0, 0);
+}
+
+void SessionJournal::clear()
+{
+    writeRecord(ClearViews, 0, 0, 0, 0);
+}
+
+bool SessionJournal::load(const std::string &fileName, PointStore &points, cv::Size &imageSize,
+                          const BoardModel *requiredBoard)
+{
+    mappedFile file;
+    if(!file.open(fileName)) {
+        std::cerr << "Unable to open journal " << fileName << std::endl;
+        return false;
+    }
+
+    const char* ptr = file.getData();
+    const char* end = ptr + file.getSize();
+    journalHeader header;
+    if(end - ptr < (ptrdiff_t)sizeof(header)) {
+        std::cerr << "Journal " << fileName << " is empty" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, ptr, sizeof(header));
+    ptr += sizeof(header);
+    if(std::memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 || header.version != JOURNAL_VERSION ||
+            (size_t)(end - ptr) < header.boardPointsNum*sizeof(cv::Point3f)) {
+        std::cerr << "Journal " << fileName << " has unsupported format" << std::endl;
+        return false;
+    }
+    if(requiredBoard && header.boardHash != getBoardHash(*requiredBoard)) {
+        std::cerr << "Journal " << fileName << " was recorded with another board" << std::endl;
+        return false;
+    }
+
+    std::vector<cv::Point3f> boardPoints(header.boardPointsNum);
+    std::memcpy(boardPoints.data(), ptr, boardPoints.size()*sizeof(cv::Point3f));
+    ptr += boardPoints.size()*sizeof(cv::Point3f);
+    points.setBoardModel(std::make_shared<const BoardModel>(boardPoints));
+    imageSize = cv::Size(header.imageWidth, header.imageHeight);
+
+    // all the blocks are multiples of 4 bytes, so the points are read in place
+    try {
+        while(end - ptr >= (ptrdiff_t)sizeof(journalRecord)) {
+            journalRecord record;
+            std::memcpy(&record, ptr, sizeof(record));
+            size_t payloadSize = record.pointsNum > 0 ? record.pointsNum*(sizeof(cv::Point2f) + sizeof(int)) : 0;
+            if(record.pointsNum < 0 || (size_t)(end - ptr) - sizeof(record) < payloadSize)
+                break;
+            ptr += sizeof(record);
+
+            if(record.type == AddView && record.pointsNum > 0) {
+                cv::Mat imagePoints(1, record.pointsNum, CV_32FC2, (void*)ptr);
+                cv::Mat ids(1, record.pointsNum, CV_32S, (void*)(ptr + record.pointsNum*sizeof(cv::Point2f)));
+                points.addView(imagePoints, ids);
+            }
+            else if(record.type == RemoveView && record.index < points.getViewsNumber())
+                points.removeView((size_t)record.index);
+            else if(record.type == ClearViews)
+                points.clear();
+            ptr += payloadSize;
+        }
+    }
+    catch(const cv::Exception& e) {
+        std::cerr << "Journal " << fileName << " is corrupted: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,146 @@
+#include "undistortMap.hpp"
+#include "profiler.hpp"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace calib;
+
+#define MAP_DISPLACEMENT_THRESHOLD 0.5
+#define MAP_CHECK_GRID_SIZE 8
+#define MAP_TILE_ROWS 64
+
+UndistortMap::UndistortMap()
+{
+    mHasRequest = false;
+    mRequestId = 0;
+    mIsEnabled = false;
+    mStop = false;
+}
+
+UndistortMap::~UndistortMap()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    if(mThread.joinable())
+        mThread.join();
+}
+
+double UndistortMap::getMaxDisplacement(const mapParameters &first, const mapParameters &second)
+{
+    // source pixels of a sparse grid of map cells under both parameter sets
+    std::vector<cv::Point2f> cells;
+    for(int i = 0; i <= MAP_CHECK_GRID_SIZE; i++)
+        for(int j = 0; j <= MAP_CHECK_GRID_SIZE; j++)
+            cells.push_back(cv::Point2f((float)j * (first.size.width - 1) / MAP_CHECK_GRID_SIZE,
+                                        (float)i * (first.size.height - 1) / MAP_CHECK_GRID_SIZE));
+
+    std::vector<cv::Point2f> sources[2];
+    const mapParameters* params[2] = { &first, &second };
+    cv::Mat zeroVec = cv::Mat::zeros(3, 1, CV_64F);
+    for(int k = 0; k < 2; k++) {
+        cv::Mat newCameraInv = params[k]->newCameraMatrix.inv();
+        std::vector<cv::Point3f> rays;
+        for(const cv::Point2f& cell : cells) {
+            cv::Mat ray = newCameraInv * (cv::Mat_<double>(3, 1) << cell.x, cell.y, 1);
+            rays.push_back(cv::Point3f((float)ray.at<double>(0), (float)ray.at<double>(1), (float)ray.at<double>(2)));
+        }
+        cv::projectPoints(rays, zeroVec, zeroVec, params[k]->cameraMatrix, params[k]->distCoeffs, sources[k]);
+    }
+
+    double maxDisplacement = 0;
+    for(size_t i = 0; i < cells.size(); i++)
+        maxDisplacement = std::max(maxDisplacement, (double)cv::norm(sources[0][i] - sources[1][i]));
+    return maxDisplacement;
+}
+
+void UndistortMap::update(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, cv::Size imageSize, cv::Size mapSize)
+{
+    double scale = (double)mapSize.width / imageSize.width;
+    cv::Mat mapScale = (cv::Mat_<double>(3, 3) << scale, 0, 0, 0, scale, 0, 0, 0, 1);
+    mapParameters params;
+    params.cameraMatrix = mapScale * cameraMatrix;
+    params.distCoeffs = distCoeffs.clone();
+    params.newCameraMatrix = mapScale * cv::getOptimalNewCameraMatrix(cameraMatrix, distCoeffs, imageSize, 0.0, imageSize);
+    params.size = mapSize;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mRequestedParams.size == params.size && mRequestedParams.distCoeffs.size() == params.distCoeffs.size() &&
+            getMaxDisplacement(mRequestedParams, params) < MAP_DISPLACEMENT_THRESHOLD)
+        return;
+
+    mRequestedParams = params;
+    mHasRequest = true;
+    mRequestId++;
+    if(!mThread.joinable())
+        mThread = std::thread(&UndistortMap::run, this);
+    mCondition.notify_all();
+}
+
+void UndistortMap::setEnabled(bool isEnabled)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIsEnabled = isEnabled;
+    mCondition.notify_all();
+}
+
+bool UndistortMap::getMaps(cv::Mat &map1, cv::Mat &map2) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    map1 = mMap1;
+    map2 = mMap2;
+    return !mMap1.empty();
+}
+
+bool UndistortMap::build(const mapParameters &params, unsigned requestId, cv::Mat &map1, cv::Mat &map2)
+{
+    ScopedTimer timer(ProfileStage::UndistortMap);
+    map1.create(params.size, CV_16SC2);
+    map2.create(params.size, CV_16UC1);
+
+    // a tile is the map of a shifted principal point, written straight into the full tables
+    for(int row = 0; row < params.size.height; row += MAP_TILE_ROWS) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(mStop || requestId != mRequestId)
+                return false;
+        }
+        int rows = std::min(MAP_TILE_ROWS, params.size.height - row);
+        cv::Mat tileCameraMatrix = params.newCameraMatrix.clone();
+        tileCameraMatrix.at<double>(1, 2) -= row;
+        cv::Mat tileMap1 = map1.rowRange(row, row + rows), tileMap2 = map2.rowRange(row, row + rows);
+        cv::initUndistortRectifyMap(params.cameraMatrix, params.distCoeffs, cv::noArray(), tileCameraMatrix,
+                                    cv::Size(params.size.width, rows), CV_16SC2, tileMap1, tileMap2);
+    }
+    return true;
+}
+
+void UndistortMap::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true) {
+        mCondition.wait(lock, [this] { return mStop || (mIsEnabled && mHasRequest); });
+        if(mStop)
+            break;
+
+        mapParameters params = mRequestedParams;
+        unsigned requestId = mRequestId;
+        mHasRequest = false;
+        lock.unlock();
+
+        // fresh tables every time, frames being remapped keep the previous ones
+        cv::Mat map1, map2;
+        bool isBuilt = build(params, requestId, map1, map2);
+
+        lock.lock();
+        if(isBuilt && requestId == mRequestId) {
+            mMap1 = map1;
+            mMap2 = map2;
+        }
+    }
+}